@@ -0,0 +1,54 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "../Server/Socket.h"
+#include "../Server/Protocol.h"
+
+#include <vector>
+
+// Port used by benchmarks that need a loopback socket.
+const int BenchmarkPort = 3999;
+
+// Print percentiles of latency samples, in microseconds.
+void PrintLatency(const wchar_t * name, std::vector < double > & samples);
+
+// Replies from a server, read by the benchmarks that act as clients.
+class ReplyStream
+{
+protected:
+	std::vector < char > received;
+	std::size_t at;
+
+public:
+	ReplyStream() : at(0) { }
+
+	// Forget what has been received, for a new connection.
+	void Clear() { received.clear(); at = 0; }
+	// Receive what is waiting, up to timeout ms. Returns the bytes received.
+	int Receive(ts::TcpSocket & s, int timeout = 0);
+	// The next complete reply, followed by its payload. Returns NULL if the rest 
+	// of it hasn't arrived. Valid until the next Receive.
+	const Packet * Next();
+};
+
+// Send a C_CLOCK request stamped with the current time.
+void SendClock(ts::TcpSocket & s);
+// Microseconds since the request a C_CLOCK reply answers was sent.
+double ClockRtt(const Packet & reply);
+
+// Benchmarks.
+int Jitter(int argc, wchar_t ** argv);
+int Microbenchmarks(int argc, wchar_t ** argv);
+int Soak(int argc, wchar_t ** argv);
+int Paste(int argc, wchar_t ** argv);
+int Recover(int argc, wchar_t ** argv);
+int Gestures(int argc, wchar_t ** argv);
+int Loopback(int argc, wchar_t ** argv);
+
+// Keeps microbenchmark results alive so the compiler can't remove the work.
+extern volatile unsigned int Sink;
+
+// Microbenchmarks that share data with a benchmark above.
+void GestureTraces(int iterations);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "Benchmark.h"
+#include "../Server/Gesture.h"
+#include "../Server/Protocol.h"
+
+#include <cstdio>
+
+// Touch traces, as the server receives them in C_TOUCH packets: coordinates
+// scaled so the touch slop is 16 units, and times in client milliseconds.
+// Each is replayed through a new recognizer and has to produce exactly the
+// gestures expected.
+struct GestureTrace
+{
+	const wchar_t * Name;
+	int Mode;
+	const TouchSample * Samples;
+	int SampleCount;
+	const Gesture * Expected;
+	int ExpectedCount;
+};
+
+#define GESTURE_TRACE(name, mode, samples, expected) { name, mode, samples, sizeof(samples) / sizeof(samples[0]), expected, sizeof(expected) / sizeof(expected[0]) }
+
+// One finger tap.
+const TouchSample TapSamples[] = 
+{
+	{ 0, TA_DOWN, 100, 100, 0 },
+	{ 0, TA_UP, 102, 101, 80 },
+};
+const Gesture TapGestures[] = { Gesture(GE_BUTTONDOWN, 0), Gesture(GE_BUTTONUP, 0) };
+
+// One finger move. The first sample only starts the move.
+const TouchSample MoveSamples[] = 
+{
+	{ 0, TA_DOWN, 100, 100, 0 },
+	{ 0, TA_MOVE, 110, 100, 16 },
+	{ 0, TA_MOVE, 130, 105, 32 },
+	{ 0, TA_MOVE, 150, 110, 48 },
+	{ 0, TA_UP, 150, 110, 64 },
+};
+const Gesture MoveGestures[] = { Gesture(GE_MOVE, 20, 5), Gesture(GE_MOVE, 20, 5) };
+
+// One finger down in the scroll bar.
+const TouchSample ScrollBarSamples[] = 
+{
+	{ 0, TA_DOWN | TA_EDGE, 300, 100, 0 },
+	{ 0, TA_MOVE, 300, 110, 16 },
+	{ 0, TA_MOVE, 300, 130, 32 },
+	{ 0, TA_UP, 300, 130, 48 },
+};
+const Gesture ScrollBarGestures[] = { Gesture(GE_SCROLL, 0, -40) };
+
+// Two finger tap in scroll mode is a right click.
+const TouchSample TwoFingerTapSamples[] = 
+{
+	{ 0, TA_DOWN, 100, 100, 0 },
+	{ 1, TA_DOWN, 200, 100, 10 },
+	{ 1, TA_UP, 200, 100, 60 },
+	{ 0, TA_UP, 100, 100, 70 },
+};
+const Gesture TwoFingerTapGestures[] = { Gesture(GE_BUTTONDOWN, 1), Gesture(GE_BUTTONUP, 1) };
+
+// Two fingers moving apart in scroll mode zoom instead.
+const TouchSample PinchSamples[] = 
+{
+	{ 0, TA_DOWN, 100, 100, 0 },
+	{ 1, TA_DOWN, 200, 100, 5 },
+	{ 1, TA_MOVE, 240, 100, 20 },
+	{ 1, TA_MOVE, 260, 100, 36 },
+	{ 1, TA_UP, 260, 100, 50 },
+	{ 0, TA_UP, 100, 100, 60 },
+};
+const Gesture PinchGestures[] = { Gesture(GE_ZOOM, 0, 40), Gesture(GE_ZOOM, 0, 20) };
+
+// Two fingers in drag mode, the first one drags.
+const TouchSample DragSamples[] = 
+{
+	{ 0, TA_DOWN, 100, 100, 0 },
+	{ 1, TA_DOWN, 150, 100, 5 },
+	{ 0, TA_MOVE, 130, 100, 20 },
+	{ 0, TA_MOVE, 150, 110, 36 },
+	{ 0, TA_UP, 150, 110, 50 },
+	{ 1, TA_UP, 150, 100, 60 },
+};
+const Gesture DragGestures[] = { Gesture(GE_BUTTONDOWN, 0), Gesture(GE_MOVE, 20, 10), Gesture(GE_BUTTONUP, 0) };
+
+const GestureTrace Traces[] = 
+{
+	GESTURE_TRACE(L"tap", 0, TapSamples, TapGestures),
+	GESTURE_TRACE(L"move", 0, MoveSamples, MoveGestures),
+	GESTURE_TRACE(L"scroll bar", 0, ScrollBarSamples, ScrollBarGestures),
+	GESTURE_TRACE(L"two finger tap", 2, TwoFingerTapSamples, TwoFingerTapGestures),
+	GESTURE_TRACE(L"pinch", 2, PinchSamples, PinchGestures),
+	GESTURE_TRACE(L"drag", 1, DragSamples, DragGestures),
+};
+const int TraceCount = sizeof(Traces) / sizeof(Traces[0]);
+
+void Replay(GestureRecognizer & recognizer, const GestureTrace & trace, std::vector < Gesture > & out)
+{
+	recognizer.Reset();
+	recognizer.Mode = trace.Mode;
+	for(int i = 0; i < trace.SampleCount; ++i)
+		recognizer.Touch(trace.Samples[i], out);
+}
+
+void PrintGestures(const wchar_t * label, const Gesture * gestures, int count)
+{
+	wprintf(L"    %s:", label);
+	for(int i = 0; i < count; ++i)
+		wprintf(L" (%i %i %i)", (int)gestures[i].Event, gestures[i].dx, gestures[i].dy);
+	wprintf(L"\n");
+}
+
+int Gestures(int argc, wchar_t ** argv)
+{
+	int failed = 0;
+	GestureRecognizer recognizer;
+	for(int i = 0; i < TraceCount; ++i)
+	{
+		const GestureTrace & trace = Traces[i];
+		std::vector < Gesture > out;
+		Replay(recognizer, trace, out);
+
+		bool match = (int)out.size() == trace.ExpectedCount;
+		for(int j = 0; match && j < trace.ExpectedCount; ++j)
+		{
+			const Gesture & a = out[j];
+			const Gesture & b = trace.Expected[j];
+			match = a.Event == b.Event && a.dx == b.dx && a.dy == b.dy;
+		}
+
+		wprintf(L"%-24s %s\n", trace.Name, match ? L"ok" : L"FAILED");
+		if(!match)
+		{
+			PrintGestures(L"expected", trace.Expected, trace.ExpectedCount);
+			PrintGestures(L"recognized", out.empty() ? NULL : &out[0], (int)out.size());
+			++failed;
+		}
+	}
+
+	wprintf(L"%i of %i traces failed\n", failed, TraceCount);
+	return failed == 0 ? 0 : 1;
+}
+
+// Microbenchmark, replays every trace per iteration.
+void GestureTraces(int iterations)
+{
+	GestureRecognizer recognizer;
+	std::vector < Gesture > out;
+	out.reserve(64);
+	for(int i = 0; i < iterations; ++i)
+	{
+		for(int j = 0; j < TraceCount; ++j)
+		{
+			out.clear();
+			Replay(recognizer, Traces[j], out);
+		}
+	}
+	Sink += out.size();
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "Benchmark.h"
+#include "../Server/Socket.h"
+#include "../Server/Thread.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace ts;
+
+// Spins a core at normal priority.
+class Load : public Thread
+{
+protected:
+	void Main(const volatile bool & run)
+	{
+		volatile unsigned int x = 0;
+		while(run)
+			++x;
+	}
+};
+
+// Plays the part of the server thread: waits for a packet, injects input,
+// and records the time from the packet being sent until the input was injected.
+class Receiver : public Thread
+{
+protected:
+	UdpSocket & socket;
+	bool lowLatency;
+	size_t count;
+
+	void Main(const volatile bool & run)
+	{
+		if(lowLatency && !SetLowLatency())
+			wprintf(L"Failed to enable low latency mode\n");
+
+		double frequency = (double)Frequency();
+		Address from;
+		__int64 sent;
+		while(run && samples.size() < count)
+		{
+			if(socket.ReceiveFrom(&sent, sizeof(sent), from, 100) != sizeof(sent))
+				continue;
+
+			// A zero length move doesn't disturb the cursor.
+			INPUT in = { 0 };
+			in.type = INPUT_MOUSE;
+			in.mi.dwFlags = MOUSEEVENTF_MOVE;
+			SendInput(1, &in, sizeof(in));
+
+			samples.push_back((Time() - sent) * 1e6 / frequency);
+		}
+	}
+
+public:
+	std::vector < double > samples;
+
+	Receiver(UdpSocket & socket, bool lowLatency, size_t count) : socket(socket), lowLatency(lowLatency), count(count) 
+	{ 
+		samples.reserve(count);
+	}
+	~Receiver() { Stop(); }
+};
+
+void Measure(const wchar_t * name, int loads, bool lowLatency, size_t count)
+{
+	UdpSocket socket;
+	socket.Bind(BenchmarkPort, false);
+	UdpSocket sender;
+	sender.Bind();
+	Address to = Address::LocalHost(BenchmarkPort);
+
+	Load load[64];
+	for(int i = 0; i < loads; ++i)
+		load[i].Run();
+
+	Receiver receiver(socket, lowLatency, count);
+	receiver.Run();
+	while(receiver.IsRunning())
+	{
+		__int64 now = Time();
+		sender.SendTo(&now, sizeof(now), to);
+		Sleep(1);
+	}
+
+	for(int i = 0; i < loads; ++i)
+		load[i].Stop();
+
+	PrintLatency(name, receiver.samples);
+}
+
+int Jitter(int argc, wchar_t ** argv)
+{
+	size_t count = argc > 0 ? _wtoi(argv[0]) : 1000;
+
+	// Two busy threads per core.
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	int loads = std::min(2 * (int)info.dwNumberOfProcessors, 64);
+
+	wprintf(L"Wakeup to inject latency, %u samples, %i load threads\n", (unsigned)count, loads);
+	Measure(L"idle", 0, false, count);
+	Measure(L"load", loads, false, count);
+	Measure(L"load, low latency", loads, true, count);
+	return 0;
+}
\ No newline at end of file
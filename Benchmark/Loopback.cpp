@@ -0,0 +1,277 @@
+#include "Benchmark.h"
+#include "../Server/Server.h"
+#include "../Server/Thread.h"
+#include "../Client/Client.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace ts;
+
+// Exposes the packet decoder, for a stream received without the server thread.
+class LoopbackDecoder : public Server
+{
+public:
+	// Decode the packets the way local input is, each followed by its payload. 
+	// Returns the packets decoded, and the bytes left over that weren't one.
+	int Decode(const std::vector < char > & stream, std::vector < INPUT > & input, int & leftover)
+	{
+		int packets = 0;
+		const char * at = stream.empty() ? NULL : &stream[0];
+		const char * end = at + stream.size();
+		while(end - at >= (int)sizeof(Packet))
+		{
+			const Packet & p = *(const Packet *)at;
+			localPayload = at + sizeof(Packet);
+			localRemaining = (int)(end - localPayload);
+			// The handshake answered C_HELLO, there's no client socket to reply on.
+			if(p.Control != C_HELLO)
+			{
+				HandlePacket(p, input);
+				++packets;
+			}
+			at = localPayload;
+		}
+		localPayload = NULL;
+		leftover = (int)(end - at);
+		return packets;
+	}
+};
+
+// Plays the server end of a connection: answers the handshake, receives
+// everything the client sends until it hangs up, then decodes the stream
+// with the server's packet handler.
+class LoopbackServer : public Thread
+{
+protected:
+	TcpSocket listener;
+	std::vector < char > stream;
+	LoopbackDecoder decoder;
+
+	void Receive(const volatile bool & run)
+	{
+		TcpSocket s;
+		Address from;
+		s.Accept(listener, from);
+
+		Packet p = { 0 };
+		if(s.Receive(&p, sizeof(p), 2000) != sizeof(p) || (p.Control != C_CONNECT && p.Control != C_RESUME))
+			throw socket_exception("LoopbackServer::Receive", WSAECONNREFUSED);
+		p.Control = C_CONNECT;
+		s.Send(&p, sizeof(p));
+		s.SetBlocking(false);
+
+		char chunk[4096];
+		while(run)
+		{
+			int n = s.Receive(chunk, sizeof(chunk), 10);
+			if(n > 0)
+				stream.insert(stream.end(), chunk, chunk + n);
+			else if(s.IsClosed())
+				break;
+		}
+	}
+
+	void Main(const volatile bool & run)
+	{
+		try
+		{
+			Receive(run);
+			__int64 start = Time();
+			packets = decoder.Decode(stream, input, leftover);
+			decodeTime = Time() - start;
+		}
+		catch(socket_exception & ex)
+		{
+			wprintf(L"Loopback server failed: %S\n", ex.what());
+		}
+	}
+
+public:
+	// What the stream decoded to, and the bytes left over that weren't a packet.
+	std::vector < INPUT > input;
+	int packets;
+	int leftover;
+	__int64 decodeTime;
+
+	LoopbackServer() : packets(0), leftover(-1), decodeTime(0)
+	{
+		listener.Listen(Address::LocalHost(BenchmarkPort));
+	}
+	~LoopbackServer() { Stop(); }
+};
+
+// Length of the edit that replaces a whole line of text, more than one 
+// C_COMPOSE packet deletes.
+const int LongEdit = MaxTextLength + 476;
+
+// Input the script below should be decoded to. The text is what's left once 
+// the backspaces have been applied to it.
+struct Decoded
+{
+	int dx, dy;
+	int buttonsDown, buttonsUp;
+	int wheel;
+	int keys, backspaces;
+	std::wstring text;
+
+	Decoded() : dx(0), dy(0), buttonsDown(0), buttonsUp(0), wheel(0), keys(0), backspaces(0) { }
+
+	bool operator == (const Decoded & r) const
+	{
+		return dx == r.dx && dy == r.dy && buttonsDown == r.buttonsDown && buttonsUp == r.buttonsUp &&
+			wheel == r.wheel && keys == r.keys && backspaces == r.backspaces && text == r.text;
+	}
+};
+
+// Encode one round of every kind of input packet. Returns the packets encoded,
+// or -1 if the client ran out of room.
+static int EncodeRound(Client & client)
+{
+	MotionSample samples[4];
+	for(int i = 0; i < 4; ++i)
+	{
+		samples[i].dx = 2 * MotionScale;
+		samples[i].dy = (short)-MotionScale;
+		samples[i].Time = 0;
+	}
+
+	bool ok =
+		client.Move(3, -2) &&
+		client.Moves(samples, 4) &&
+		client.ButtonDown(0) &&
+		client.ButtonUp(0) &&
+		client.Scroll(1) &&
+		client.Char(L'a') &&
+		client.Key(KEYCODE_A, 0, 2) &&
+		client.Text(L"hello", 5) &&
+		client.Compose(1, L"ok", 2) &&
+		client.Null();
+	return ok ? 10 : -1;
+}
+
+// Type a line too long for one packet, then replace all of it. Returns the 
+// packets encoded, or -1 if the client ran out of room.
+static int EncodeLongEdit(Client & client)
+{
+	std::wstring line(LongEdit, L'x');
+	bool ok =
+		client.Text(line.c_str(), LongEdit) &&
+		client.Compose(LongEdit, L"ok", 2);
+	return ok ? 4 : -1;
+}
+
+// What rounds of EncodeRound, then EncodeLongEdit, decode to.
+static Decoded Expected(int rounds)
+{
+	Decoded d;
+	d.dx = rounds * (3 + 4 * 2);
+	d.dy = rounds * (-2 - 4);
+	d.buttonsDown = d.buttonsUp = rounds;
+	d.wheel = rounds;
+	d.keys = rounds * 2;
+	d.backspaces = rounds + LongEdit;
+	for(int i = 0; i < rounds; ++i)
+		d.text += L"ahellok";
+	d.text += L"ok";
+	return d;
+}
+
+static Decoded Summarize(const std::vector < INPUT > & input)
+{
+	Decoded d;
+	for(std::size_t i = 0; i < input.size(); ++i)
+	{
+		const INPUT & in = input[i];
+		if(in.type == INPUT_MOUSE)
+		{
+			if(in.mi.dwFlags & MOUSEEVENTF_MOVE)
+			{
+				d.dx += in.mi.dx;
+				d.dy += in.mi.dy;
+			}
+			if(in.mi.dwFlags & MOUSEEVENTF_LEFTDOWN)
+				++d.buttonsDown;
+			if(in.mi.dwFlags & MOUSEEVENTF_LEFTUP)
+				++d.buttonsUp;
+			if(in.mi.dwFlags & MOUSEEVENTF_WHEEL)
+				d.wheel += (int)in.mi.mouseData;
+		}
+		else if(in.type == INPUT_KEYBOARD && !(in.ki.dwFlags & KEYEVENTF_KEYUP))
+		{
+			if(in.ki.dwFlags & KEYEVENTF_UNICODE)
+				d.text += (wchar_t)in.ki.wScan;
+			else if(in.ki.wVk == 'A')
+				++d.keys;
+			else if(in.ki.wVk == VK_BACK)
+			{
+				++d.backspaces;
+				if(!d.text.empty())
+					d.text.erase(d.text.size() - 1);
+			}
+		}
+	}
+	return d;
+}
+
+int Loopback(int argc, wchar_t ** argv)
+{
+	int rounds = argc > 0 ? std::max(_wtoi(argv[0]), 1) : 10000;
+
+	LoopbackServer server;
+	server.input.reserve(rounds * 32 + LongEdit * 6);
+	server.Run();
+
+	Client client;
+	if(!client.Connect(Address::LocalHost(BenchmarkPort)))
+	{
+		wprintf(L"The loopback server refused the connection\n");
+		return 1;
+	}
+
+	// The server doesn't answer C_HELLO, so the client has no credit limit,
+	// only the room in its send buffer.
+	int encoded = 0;
+	__int64 encodeTime = 0;
+	for(int i = 0; i < rounds; ++i)
+	{
+		while(client.Pending() > 4096 && client.Wait(100))
+			;
+
+		__int64 start = Time();
+		int n = EncodeRound(client);
+		encodeTime += Time() - start;
+		if(n < 0)
+		{
+			wprintf(L"The client ran out of room after %i packets\n", encoded);
+			return 1;
+		}
+		encoded += n;
+		client.Poll();
+	}
+	while(client.Pending() > 4096 && client.Wait(100))
+		;
+	int n = EncodeLongEdit(client);
+	if(n < 0)
+	{
+		wprintf(L"The client ran out of room after %i packets\n", encoded);
+		return 1;
+	}
+	encoded += n;
+	while(client.Pending() > 0 && client.Wait(100))
+		;
+	client.Disconnect();
+
+	while(server.IsRunning())
+		Sleep(10);
+
+	double frequency = (double)Frequency();
+	wprintf(L"%-24s %8.1f ns/packet\n", L"client encode", encodeTime * 1e9 / frequency / encoded);
+	if(server.packets > 0)
+		wprintf(L"%-24s %8.1f ns/packet\n", L"server decode", server.decodeTime * 1e9 / frequency / server.packets);
+
+	bool ok = server.packets == encoded && server.leftover == 0 && Summarize(server.input) == Expected(rounds);
+	wprintf(L"%i packets encoded, %i decoded, %i bytes left over, input %s\n",
+		encoded, server.packets, server.leftover, ok ? L"matches" : L"DOESN'T MATCH");
+	return ok ? 0 : 1;
+}
\ No newline at end of file
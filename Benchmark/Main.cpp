@@ -0,0 +1,119 @@
+#include "Benchmark.h"
+#include "../Server/Socket.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace ts;
+
+void PrintLatency(const wchar_t * name, std::vector < double > & samples)
+{
+	if(samples.empty())
+	{
+		wprintf(L"%-24s no samples\n", name);
+		return;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	size_t n = samples.size();
+	wprintf(L"%-24s n=%-6u p50=%8.1f p99=%8.1f p99.9=%8.1f max=%8.1f us\n", 
+		name, (unsigned)n, samples[n / 2], samples[n * 99 / 100], samples[n * 999 / 1000], samples[n - 1]);
+}
+
+int ReplyStream::Receive(TcpSocket & s, int timeout)
+{
+	// The replies already read are done with.
+	received.erase(received.begin(), received.begin() + at);
+	at = 0;
+
+	char chunk[4096];
+	int n = s.Receive(chunk, sizeof(chunk), timeout);
+	if(n > 0)
+		received.insert(received.end(), chunk, chunk + n);
+	return n;
+}
+
+const Packet * ReplyStream::Next()
+{
+	if(received.size() - at < sizeof(Packet))
+		return NULL;
+
+	const Packet * p = (const Packet *)&received[at];
+	std::size_t size = sizeof(Packet);
+	if(p->Control == C_MACROS)
+		size += ntohs(p->Length) * sizeof(wchar_t);
+	else if(p->Control == C_CLOCK)
+		size += sizeof(ClockSync);
+	if(received.size() - at < size)
+		return NULL;
+	at += size;
+	return p;
+}
+
+void SendClock(TcpSocket & s)
+{
+	char packet[sizeof(Packet) + sizeof(ClockSync)] = { 0 };
+	Packet & c = *(Packet *)packet;
+	c.Control = C_CLOCK;
+	c.Length = htons(sizeof(ClockSync));
+	ClockSync sync = { 0 };
+	sync.Origin = Swap64(Microseconds());
+	sync.Rtt = htonl(-1);
+	memcpy(packet + sizeof(Packet), &sync, sizeof(sync));
+	s.Send(packet, sizeof(packet));
+}
+
+double ClockRtt(const Packet & reply)
+{
+	ClockSync sync;
+	memcpy(&sync, &reply + 1, sizeof(sync));
+	return (double)(Microseconds() - (__int64)Swap64(sync.Origin));
+}
+
+int wmain(int argc, wchar_t ** argv)
+{
+	if(argc < 2)
+	{
+		wprintf(L"Usage: Benchmark <benchmark> [options]\n");
+		wprintf(L"  jitter [samples]    Wakeup to inject latency, with and without low latency mode\n");
+		wprintf(L"  micro [filter] [/json file] [/time seconds]\n");
+		wprintf(L"                      Per operation cost of the server's hot paths\n");
+		wprintf(L"  soak [/minutes n] [/interval s] [/port n] [/password p] [/churn threads] [/beacons rate] [/pid n]\n");
+		wprintf(L"                      Connection churn and beacon flood against a running server\n");
+		wprintf(L"  paste [MB]          Clipboard transfer throughput, and input latency behind it\n");
+		wprintf(L"  recover [trials]    Time for the server to answer after its thread fails or stalls\n");
+		wprintf(L"  gestures            Replay touch traces through the gesture recognizer\n");
+		wprintf(L"  loopback [rounds]   Encode input with the client library and decode it with the server\n");
+		return 1;
+	}
+
+	InitSockets();
+
+	int result = 1;
+	try
+	{
+		if(_wcsicmp(argv[1], L"jitter") == 0)
+			result = Jitter(argc - 2, argv + 2);
+		else if(_wcsicmp(argv[1], L"micro") == 0)
+			result = Microbenchmarks(argc - 2, argv + 2);
+		else if(_wcsicmp(argv[1], L"soak") == 0)
+			result = Soak(argc - 2, argv + 2);
+		else if(_wcsicmp(argv[1], L"paste") == 0)
+			result = Paste(argc - 2, argv + 2);
+		else if(_wcsicmp(argv[1], L"recover") == 0)
+			result = Recover(argc - 2, argv + 2);
+		else if(_wcsicmp(argv[1], L"gestures") == 0)
+			result = Gestures(argc - 2, argv + 2);
+		else if(_wcsicmp(argv[1], L"loopback") == 0)
+			result = Loopback(argc - 2, argv + 2);
+		else
+			wprintf(L"Unknown benchmark %s\n", argv[1]);
+	}
+	catch(std::exception & ex)
+	{
+		printf("%s\n", ex.what());
+	}
+
+	CloseSockets();
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,424 @@
+#include "Benchmark.h"
+#include "../Server/Server.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdarg>
+#include <ctime>
+
+using namespace ts;
+
+// Server functions under test.
+UINT MapKeycode(ANDROID_KEYCODE keycode);
+INPUT MouseMove(int dx, int dy);
+INPUT KeyDown(WORD vk);
+INPUT KeyUp(WORD vk);
+void AppendText(std::vector < INPUT > & input, const wchar_t * text, int length);
+
+// The server's log, without the window it's shown in. Formats the message
+// the same way, so the cost of logging from the server thread is measured.
+void Log(int level, const wchar_t * s, ...)
+{
+	wchar_t buffer[1024] = { 0 };
+	va_list args;
+	va_start(args, s);
+	_vsnwprintf_s(buffer, sizeof(buffer) / sizeof(buffer[0]) - 1, s, args);
+	va_end(args);
+}
+
+volatile unsigned int Sink = 0;
+
+// Exposes the packet decoder.
+class MicroServer : public Server
+{
+public:
+	void Decode(const Packet & p, std::vector < INPUT > & input) { HandlePacket(p, input); }
+	// Decode a packet with its payload, the way local input is.
+	void Decode(const Packet & p, const void * payload, int size, std::vector < INPUT > & input)
+	{
+		localPayload = (const char *)payload;
+		localRemaining = size;
+		HandlePacket(p, input);
+		localPayload = NULL;
+	}
+};
+
+// Benchmarks, each runs the operation 'iterations' times.
+void DecodeMouseMove(int iterations)
+{
+	MicroServer server;
+	std::vector < INPUT > input;
+	input.reserve(1024);
+
+	Packet p = { 0 };
+	p.Control = C_MOUSE_MOVE;
+	p.Delta2D.dx = 3;
+	p.Delta2D.dy = -2;
+	for(int i = 0; i < iterations; ++i)
+	{
+		if(input.size() == input.capacity())
+			input.clear();
+		server.Decode(p, input);
+	}
+	Sink += input.size();
+}
+
+void DecodeMouseMoves(int iterations)
+{
+	MicroServer server;
+	std::vector < INPUT > input;
+	input.reserve(1024);
+
+	// A frame's worth of samples from a fast stroke.
+	const int Count = 8;
+	MotionSample samples[Count];
+	for(int i = 0; i < Count; ++i)
+	{
+		samples[i].dx = htons(3 * MotionScale + i);
+		samples[i].dy = htons((unsigned short)(-2 * MotionScale - i));
+		samples[i].Time = htons(i * 2);
+	}
+
+	Packet p = { 0 };
+	p.Control = C_MOUSE_MOVES;
+	p.Motion.count = Count;
+	for(int i = 0; i < iterations; ++i)
+	{
+		if(input.size() + Count > input.capacity())
+			input.clear();
+		server.Decode(p, samples, sizeof(samples), input);
+	}
+	Sink += input.size();
+}
+
+void DecodeKey(int iterations)
+{
+	MicroServer server;
+	std::vector < INPUT > input;
+	input.reserve(1024);
+
+	Packet p = { 0 };
+	p.Control = C_KEY;
+	p.KeyEvent.keycode = htons(KEYCODE_A);
+	p.KeyEvent.repeat = 1;
+	for(int i = 0; i < iterations; ++i)
+	{
+		if(input.size() + 2 > input.capacity())
+			input.clear();
+		server.Decode(p, input);
+	}
+	Sink += input.size();
+}
+
+void MapKeycodes(int iterations)
+{
+	for(int i = 0; i < iterations; ++i)
+		Sink += MapKeycode((ANDROID_KEYCODE)(i & 0xFF));
+}
+
+void InputMouseMove(int iterations)
+{
+	for(int i = 0; i < iterations; ++i)
+		Sink += MouseMove(i & 7, -(i & 3)).mi.dx;
+}
+
+void InputKeyPress(int iterations)
+{
+	for(int i = 0; i < iterations; ++i)
+		Sink += KeyDown(VK_SPACE).ki.wVk + KeyUp(VK_SPACE).ki.wVk;
+}
+
+void InputText(int iterations)
+{
+	static const wchar_t Text[] = L"Hello, world!";
+	const int length = sizeof(Text) / sizeof(Text[0]) - 1;
+
+	std::vector < INPUT > input;
+	input.reserve(1024);
+	for(int i = 0; i < iterations; ++i)
+	{
+		input.clear();
+		AppendText(input, Text, length);
+	}
+	Sink += input.size();
+}
+
+void LogFormat(int iterations)
+{
+	for(int i = 0; i < iterations; ++i)
+		Log(OL_VERBOSE, L"MOUSE_MOVE %i %i\r\n", i & 7, -(i & 3));
+}
+
+void AddressToString(int iterations)
+{
+	Address addr = Address::LocalHost(DefaultPort);
+	for(int i = 0; i < iterations; ++i)
+		Sink += addr.ToString().size();
+}
+
+// Connect two sockets over loopback.
+void ConnectLoopback(TcpSocket & sender, TcpSocket & receiver)
+{
+	TcpSocket listener;
+	listener.Listen(BenchmarkPort, 1);
+	sender.Connect(Address::LocalHost(BenchmarkPort));
+	Address from;
+	receiver.Accept(listener, from);
+	sender.SetNoDelay(true);
+}
+
+void SocketReceive(int iterations)
+{
+	TcpSocket sender, receiver;
+	ConnectLoopback(sender, receiver);
+
+	// One packet in flight at a time, as the server sees them from a client.
+	Packet p = { 0 };
+	p.Control = C_MOUSE_MOVE;
+	for(int i = 0; i < iterations; ++i)
+	{
+		sender.Send(&p, sizeof(p));
+		int received = 0;
+		while(received < (int)sizeof(p))
+			received += receiver.Receive((char *)&p + received, sizeof(p) - received);
+	}
+	Sink += p.Control;
+}
+
+// A burst of packets from a client, received with a select and a receive per 
+// packet, and with one wait and receives of everything waiting, as the server 
+// does.
+const int Burst = 16;
+
+void SocketBurstSelect(int iterations)
+{
+	TcpSocket sender, receiver;
+	ConnectLoopback(sender, receiver);
+	receiver.SetBlocking(false);
+
+	Packet burst[Burst] = { 0 };
+	for(int i = 0; i < Burst; ++i)
+		burst[i].Control = C_MOUSE_MOVE;
+	Packet p;
+	for(int i = 0; i < iterations; ++i)
+	{
+		sender.Send(burst, sizeof(burst));
+		for(int received = 0; received < (int)sizeof(burst); )
+		{
+			int at = received % sizeof(Packet);
+			received += receiver.Receive((char *)&p + at, sizeof(Packet) - at, 10);
+		}
+	}
+	Sink += p.Control;
+}
+
+void SocketBurstEvent(int iterations)
+{
+	TcpSocket sender, receiver;
+	ConnectLoopback(sender, receiver);
+	HANDLE event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	receiver.Watch(event, FD_READ);
+
+	Packet burst[Burst] = { 0 };
+	for(int i = 0; i < Burst; ++i)
+		burst[i].Control = C_MOUSE_MOVE;
+	char stream[16384];
+	for(int i = 0; i < iterations; ++i)
+	{
+		sender.Send(burst, sizeof(burst));
+		for(int received = 0; received < (int)sizeof(burst); )
+		{
+			int n = receiver.Receive(stream, sizeof(stream));
+			if(n == 0)
+			{
+				WaitForSingleObject(event, 10);
+				ResetEvent(event);
+			}
+			received += n;
+		}
+	}
+	CloseHandle(event);
+	Sink += stream[0];
+}
+
+void LocalSubmit(int iterations)
+{
+	// Needs the ring to itself, so the server can't be running.
+	LocalInput ring;
+	LocalInputClient client;
+	if(!ring.Open() || !client.Open())
+	{
+		static bool warned = false;
+		if(!warned)
+			wprintf(L"Local input ring unavailable, is the server running?\n");
+		warned = true;
+		return;
+	}
+
+	Packet p = { 0 };
+	p.Control = C_MOUSE_MOVE;
+	char record[LocalInputRecord];
+	for(int i = 0; i < iterations; ++i)
+	{
+		client.Send(&p, sizeof(p), false);
+		Sink += ring.Read(record, sizeof(record));
+	}
+}
+
+struct Micro
+{
+	const char * name;
+	void (* fn)(int iterations);
+};
+
+const Micro Micros[] = 
+{
+	{ "Decode/MouseMove", DecodeMouseMove },
+	{ "Decode/MouseMoves", DecodeMouseMoves },
+	{ "Decode/Key", DecodeKey },
+	{ "Gesture/Trace", GestureTraces },
+	{ "MapKeycode", MapKeycodes },
+	{ "Input/MouseMove", InputMouseMove },
+	{ "Input/KeyPress", InputKeyPress },
+	{ "Input/Text", InputText },
+	{ "Log/Format", LogFormat },
+	{ "Address/ToString", AddressToString },
+	{ "Socket/ReceiveLoopback", SocketReceive },
+	{ "Socket/BurstSelect", SocketBurstSelect },
+	{ "Socket/BurstEvent", SocketBurstEvent },
+	{ "Local/Submit", LocalSubmit },
+};
+
+struct MicroResult
+{
+	const char * name;
+	int iterations;
+	double real;	// ns per iteration.
+	double cpu;		// ns per iteration.
+};
+
+// CPU time used by this thread, in ns.
+double ThreadTime()
+{
+	FILETIME creation, exit, kernel, user;
+	GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+	ULARGE_INTEGER k = { kernel.dwLowDateTime, kernel.dwHighDateTime };
+	ULARGE_INTEGER u = { user.dwLowDateTime, user.dwHighDateTime };
+	return (double)(k.QuadPart + u.QuadPart) * 100.0;
+}
+
+// Grow the iteration count until one run takes at least minTime seconds.
+MicroResult RunMicro(const Micro & micro, double minTime)
+{
+	double frequency = (double)Frequency();
+
+	MicroResult result = { micro.name, 1, 0.0, 0.0 };
+	for(;;)
+	{
+		double cpu = ThreadTime();
+		__int64 start = Time();
+		micro.fn(result.iterations);
+		double elapsed = (Time() - start) / frequency;
+		cpu = ThreadTime() - cpu;
+
+		if(elapsed >= minTime || result.iterations >= 1000000000)
+		{
+			result.real = elapsed * 1e9 / result.iterations;
+			result.cpu = cpu / result.iterations;
+			return result;
+		}
+
+		// Aim a bit past minTime, but don't grow more than 10x per step.
+		double scale = elapsed > 0.0 ? minTime * 1.4 / elapsed : 10.0;
+		scale = std::min(std::max(scale, 2.0), 10.0);
+		result.iterations = (int)std::min(result.iterations * scale, 1e9);
+	}
+}
+
+// Write results in the same layout as Google Benchmark's JSON output, so
+// runs from different builds can be compared with its tools.
+bool WriteJson(const wchar_t * path, const std::vector < MicroResult > & results)
+{
+	FILE * file = NULL;
+	if(_wfopen_s(&file, path, L"w") != 0 || !file)
+		return false;
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	char date[64];
+	time_t now = time(NULL);
+	tm local;
+	localtime_s(&local, &now);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"context\": {\n");
+	fprintf(file, "    \"date\": \"%s\",\n", date);
+	fprintf(file, "    \"num_cpus\": %u,\n", (unsigned)info.dwNumberOfProcessors);
+#ifdef NDEBUG
+	fprintf(file, "    \"library_build_type\": \"release\"\n");
+#else
+	fprintf(file, "    \"library_build_type\": \"debug\"\n");
+#endif
+	fprintf(file, "  },\n");
+	fprintf(file, "  \"benchmarks\": [\n");
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		const MicroResult & r = results[i];
+		fprintf(file, "    {\n");
+		fprintf(file, "      \"name\": \"%s\",\n", r.name);
+		fprintf(file, "      \"run_name\": \"%s\",\n", r.name);
+		fprintf(file, "      \"run_type\": \"iteration\",\n");
+		fprintf(file, "      \"iterations\": %i,\n", r.iterations);
+		fprintf(file, "      \"real_time\": %.3f,\n", r.real);
+		fprintf(file, "      \"cpu_time\": %.3f,\n", r.cpu);
+		fprintf(file, "      \"time_unit\": \"ns\"\n");
+		fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+
+	fclose(file);
+	return true;
+}
+
+int Microbenchmarks(int argc, wchar_t ** argv)
+{
+	const wchar_t * json = NULL;
+	const wchar_t * filter = NULL;
+	double minTime = 0.5;
+	for(int i = 0; i < argc; ++i)
+	{
+		if(_wcsicmp(argv[i], L"/json") == 0 && i + 1 < argc)
+			json = argv[++i];
+		else if(_wcsicmp(argv[i], L"/time") == 0 && i + 1 < argc)
+			minTime = _wtof(argv[++i]);
+		else
+			filter = argv[i];
+	}
+
+	std::vector < MicroResult > results;
+	wprintf(L"%-28s %14s %14s %12s\n", L"Benchmark", L"Time", L"CPU", L"Iterations");
+	for(size_t i = 0; i < sizeof(Micros) / sizeof(Micros[0]); ++i)
+	{
+		wchar_t name[64];
+		swprintf_s(name, L"%S", Micros[i].name);
+		if(filter && !wcsstr(name, filter))
+			continue;
+
+		MicroResult r = RunMicro(Micros[i], minTime);
+		wprintf(L"%-28s %11.1f ns %11.1f ns %12i\n", name, r.real, r.cpu, r.iterations);
+		results.push_back(r);
+	}
+
+	if(json)
+	{
+		if(!WriteJson(json, results))
+		{
+			wprintf(L"Failed to write %s\n", json);
+			return 1;
+		}
+		wprintf(L"Results written to %s\n", json);
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "Benchmark.h"
+#include "../Server/Server.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace ts;
+
+// Clipboard chunks a client keeps in flight, so input isn't stuck behind them.
+const int ChunksInFlight = 8;
+
+// Streams a clipboard transfer to a server on loopback the way the client 
+// does, while sending clock packets to measure how long input waits behind it.
+class PasteClient
+{
+protected:
+	TcpSocket s;
+	ReplyStream replies;
+
+public:
+	int credits;
+	std::vector < double > rtts;
+
+	PasteClient() : credits(0) { }
+
+	void Connect()
+	{
+		s.Connect(Address::LocalHost(BenchmarkPort));
+		s.SetNoDelay(true);
+
+		Packet p = { 0 };
+		p.Control = C_CONNECT;
+		s.Send(&p, sizeof(p));
+		Packet hello = { 0 };
+		hello.Control = C_HELLO;
+		hello.Hello.capabilities = htons(CAP_CREDITS);
+		s.Send(&hello, sizeof(hello));
+		if(s.Receive(&p, sizeof(p), 2000) != sizeof(p) || p.Control != C_CONNECT)
+			throw socket_exception("PasteClient::Connect", WSAECONNREFUSED);
+
+		// The window is granted in the C_HELLO reply, and C_HELLO used a credit.
+		if(s.Receive(&p, sizeof(p), 2000) != sizeof(p) || p.Control != C_HELLO)
+			throw socket_exception("PasteClient::Connect", WSAECONNREFUSED);
+		credits = ntohs(p.Hello.window) - 1;
+		s.SetBlocking(false);
+	}
+
+	// Read the replies that have arrived.
+	void Poll()
+	{
+		replies.Receive(s);
+		while(const Packet * r = replies.Next())
+		{
+			if(r->Control == C_CREDIT)
+				credits += ntohl(r->Count);
+			else if(r->Control == C_CLOCK)
+				rtts.push_back(ClockRtt(*r));
+		}
+	}
+
+	void SendChunk(const char * data, int length, int flags)
+	{
+		std::vector < char > packet(sizeof(Packet) + length);
+		Packet & p = *(Packet *)&packet[0];
+		p.Control = C_CLIPBOARD;
+		p.Clip.length = htons((unsigned short)length);
+		p.Clip.format = CLIP_TEXT;
+		p.Clip.flags = (unsigned char)flags;
+		if(length > 0)
+			memcpy(&packet[sizeof(Packet)], data, length);
+		s.Send(&packet[0], packet.size());
+		--credits;
+	}
+
+	void SendClock()
+	{
+		::SendClock(s);
+		--credits;
+	}
+};
+
+// Send clock packets for a while without a transfer, for a baseline.
+void MeasureIdle(PasteClient & client, double seconds)
+{
+	__int64 frequency = Frequency();
+	__int64 end = Time() + (__int64)(seconds * frequency);
+	__int64 nextClock = 0;
+	while(Time() < end)
+	{
+		client.Poll();
+		if(Time() >= nextClock && client.credits > 0)
+		{
+			client.SendClock();
+			nextClock = Time() + frequency / 100;
+		}
+		Sleep(1);
+	}
+}
+
+int Paste(int argc, wchar_t ** argv)
+{
+	int mb = argc > 0 ? std::max(_wtoi(argv[0]), 1) : 8;
+	size_t size = std::min((size_t)mb << 20, (size_t)MaxClipboardSize);
+
+	// Host a server that writes the clipboard to a file, so the real one isn't touched.
+	wchar_t path[MAX_PATH];
+	GetTempPath(MAX_PATH, path);
+	wcscat_s(path, L"TouchpadPaste.txt");
+	Server server;
+	server.SetClipboard(new FileClipboard(path));
+	if(!server.Run(BenchmarkPort, 0))
+	{
+		wprintf(L"Failed to start the server\n");
+		return 1;
+	}
+
+	std::vector < char > payload(size);
+	for(size_t i = 0; i < size; ++i)
+		payload[i] = (i % 64 == 63) ? '\n' : (char)('a' + i % 26);
+
+	PasteClient client;
+	client.Connect();
+	int window = client.credits;
+
+	MeasureIdle(client, 1.0);
+	std::vector < double > idle;
+	idle.swap(client.rtts);
+
+	wprintf(L"Pasting %u bytes in %i byte chunks\n", (unsigned)size, MaxClipboardChunk);
+	__int64 frequency = Frequency();
+	__int64 start = Time();
+	__int64 nextClock = 0;
+	size_t sent = 0;
+	while(sent < size || client.credits < window)
+	{
+		client.Poll();
+		if(Time() >= nextClock && client.credits > 0)
+		{
+			client.SendClock();
+			nextClock = Time() + frequency / 100;
+		}
+		while(sent < size && client.credits > window - ChunksInFlight)
+		{
+			int length = (int)std::min(size - sent, (size_t)MaxClipboardChunk);
+			int flags = (sent == 0 ? CLIP_BEGIN : 0) | (sent + length == size ? CLIP_END : 0);
+			client.SendChunk(&payload[sent], length, flags);
+			sent += length;
+		}
+		Sleep(0);
+	}
+	double seconds = (double)(Time() - start) / frequency;
+
+	// The server writes the file before returning the last credit.
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	bool written = GetFileAttributesEx(path, GetFileExInfoStandard, &attributes) != 0 && 
+		attributes.nFileSizeHigh == 0 && attributes.nFileSizeLow == size;
+	DeleteFile(path);
+
+	wprintf(L"%.1f MB in %.3f s, %.1f MB/s%s\n", size / 1048576.0, seconds, size / 1048576.0 / seconds, 
+		written ? L"" : L" (clipboard file doesn't match!)");
+	PrintLatency(L"round trip, idle", idle);
+	PrintLatency(L"round trip, pasting", client.rtts);
+	return written ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "Benchmark.h"
+#include "../Server/Server.h"
+#include "../Server/Metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace ts;
+
+// Give up on a trial if the server hasn't recovered in this many seconds.
+const int RecoverTimeout = 10;
+
+// A client that only checks the server is answering.
+class RecoverClient
+{
+protected:
+	TcpSocket s;
+	ReplyStream replies;
+
+public:
+	int connects;
+
+	RecoverClient() : connects(0) { }
+
+	bool IsConnected() { return s.IsValid(); }
+	void Close() { s.Close(); }
+
+	// Connect to the benchmark server. Returns false if it doesn't complete the handshake.
+	bool Connect()
+	{
+		s.Close();
+		replies.Clear();
+		s.Connect(Address::LocalHost(BenchmarkPort), false);
+
+		Packet p = { 0 };
+		p.Control = C_RESUME;
+		s.Send(&p, sizeof(p));
+		if(s.Receive(&p, sizeof(p), 100) != sizeof(p) || p.Control != C_CONNECT)
+		{
+			s.Close();
+			return false;
+		}
+		++connects;
+		return true;
+	}
+
+	// Send a clock packet, and wait up to timeout ms for the reply.
+	bool Ping(int timeout)
+	{
+		SendClock(s);
+
+		__int64 end = Time() + timeout * Frequency() / 1000;
+		while(Time() < end)
+		{
+			if(replies.Receive(s, 1) == 0 && s.IsClosed())
+				throw socket_exception("RecoverClient::Ping", WSAECONNRESET);
+
+			bool answered = false;
+			while(const Packet * r = replies.Next())
+				answered = answered || r->Control == C_CLOCK;
+			if(answered)
+				return true;
+		}
+		return false;
+	}
+};
+
+// Inject a fault, and return the microseconds until the server answers the 
+// client again after the supervisor restarts the thread or reports the stall, 
+// or -1 if it doesn't.
+double Recovery(Server & server, RecoverClient & client, SERVER_FAULT fault)
+{
+	METRIC handled = fault == SF_STALL ? M_STALLS : M_RESTARTS;
+	long before = Metric(handled);
+	__int64 frequency = Frequency();
+	server.InjectFault(fault);
+	__int64 start = Time();
+	while(Time() - start < RecoverTimeout * frequency)
+	{
+		try
+		{
+			if(!client.IsConnected() && !client.Connect())
+				continue;
+			if(client.Ping(10) && Metric(handled) > before)
+				return (double)(Time() - start) * 1e6 / frequency;
+		}
+		catch(socket_exception &)
+		{
+			client.Close();
+		}
+	}
+	return -1.0;
+}
+
+int Recover(int argc, wchar_t ** argv)
+{
+	int trials = argc > 0 ? std::max(_wtoi(argv[0]), 1) : 10;
+
+	Server server;
+	if(!server.Run(BenchmarkPort, 0))
+	{
+		wprintf(L"Failed to start the server\n");
+		return 1;
+	}
+
+	const SERVER_FAULT faults[] = { SF_THROW, SF_STALL };
+	const wchar_t * names[] = { L"recover, exception", L"recover, stall" };
+	int failed = 0;
+	for(int f = 0; f < 2; ++f)
+	{
+		RecoverClient client;
+		std::vector < double > samples;
+		for(int i = 0; i < trials; ++i)
+		{
+			double us = Recovery(server, client, faults[f]);
+			if(us < 0.0)
+				++failed;
+			else
+				samples.push_back(us);
+		}
+		PrintLatency(names[f], samples);
+		// An exception between packets shouldn't cost the client its connection.
+		wprintf(L"%-24s %i connections for %i trials\n", L"", client.connects, trials);
+	}
+
+	wprintf(L"%li restarts, %li stalls, %i trials didn't recover within %i s\n", Metric(M_RESTARTS), Metric(M_STALLS), failed, RecoverTimeout);
+	return failed == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,441 @@
+#include "Benchmark.h"
+#include "../Server/Server.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <Psapi.h>
+#include <TlHelp32.h>
+
+using namespace ts;
+
+// Counters shared by the load threads.
+struct SoakCounters
+{
+	volatile LONG cycles;
+	volatile LONG accepted;
+	volatile LONG rejected;
+	volatile LONG abandoned;
+	volatile LONG stalled;
+	volatile LONG refused;
+	volatile LONG reconnects;
+	volatile LONG inputs;
+	volatile LONG pings;
+	volatile LONG acks;
+};
+
+SoakCounters Counters = { 0 };
+
+// The client the user is actually using: a steady stream of zero length 
+// moves within the credit window, and a clock packet every 100 ms to 
+// measure how long the server takes to get to it.
+class InputStream : public Thread
+{
+protected:
+	Address addr;
+	int password;
+
+	void Stream(const volatile bool & run)
+	{
+		TcpSocket s;
+		s.Connect(addr);
+		s.SetNoDelay(true);
+
+		Packet p = { 0 };
+		p.Control = C_RESUME;
+		p.Password = htonl(password);
+		s.Send(&p, sizeof(p));
+		Packet hello = { 0 };
+		hello.Control = C_HELLO;
+		hello.Hello.capabilities = htons(CAP_CREDITS);
+		s.Send(&hello, sizeof(hello));
+		s.SetBlocking(false);
+
+		__int64 frequency = Frequency();
+		__int64 lastReply = Time();
+		__int64 nextMove = lastReply;
+		__int64 nextClock = lastReply;
+		bool connected = false;
+		// C_HELLO used a credit of the window its reply grants.
+		int credits = -1;
+		ReplyStream replies;
+		while(run)
+		{
+			if(replies.Receive(s) > 0)
+				lastReply = Time();
+
+			while(const Packet * r = replies.Next())
+			{
+				if(r->Control == C_DISCONNECT)
+				{
+					throw socket_exception("InputStream::Stream", WSAECONNRESET);
+				}
+				else if(r->Control == C_CONNECT)
+				{
+					connected = true;
+				}
+				else if(r->Control == C_HELLO)
+				{
+					credits += ntohs(r->Hello.window);
+				}
+				else if(r->Control == C_CREDIT)
+				{
+					credits += ntohl(r->Count);
+				}
+				else if(r->Control == C_CLOCK)
+				{
+					double rtt = ClockRtt(*r);
+					Lock lock(samplesLock);
+					samples.push_back(rtt);
+				}
+			}
+
+			// Replaced by another client, or the server stopped serving us.
+			__int64 now = Time();
+			if(now - lastReply > 2 * frequency)
+				return;
+
+			if(connected && credits > 0 && now >= nextMove)
+			{
+				p.Control = C_MOUSE_MOVE;
+				p.Delta2D.dx = 0;
+				p.Delta2D.dy = 0;
+				s.Send(&p, sizeof(p));
+				--credits;
+				nextMove = now + frequency / 500;
+				InterlockedIncrement(&Counters.inputs);
+			}
+			if(connected && credits > 0 && now >= nextClock)
+			{
+				SendClock(s);
+				--credits;
+				nextClock = now + frequency / 10;
+			}
+			Sleep(1);
+		}
+	}
+
+	void Main(const volatile bool & run)
+	{
+		while(run)
+		{
+			try
+			{
+				Stream(run);
+			}
+			catch(socket_exception &)
+			{
+			}
+			if(!run)
+				break;
+			InterlockedIncrement(&Counters.reconnects);
+			Sleep(100);
+		}
+	}
+
+public:
+	CriticalSection samplesLock;
+	std::vector < double > samples;
+
+	InputStream(const Address & addr, int password) : addr(addr), password(password) { }
+	~InputStream() { Stop(); }
+};
+
+// Connects and disconnects as fast as the server will take it. Of every 64 
+// cycles, one logs in with the right password (replacing the input stream), 
+// half hang up before sending anything, and the rest send a bad password. 
+// Every 256th cycle connects and stalls the handshake past the server's timeout.
+// Logins are resumes, so the server doesn't show a notification for each one.
+class Churn : public Thread
+{
+protected:
+	Address addr;
+	int password;
+
+	void Cycle(unsigned int cycle)
+	{
+		TcpSocket s;
+		s.Connect(addr);
+
+		if(cycle % 256 == 255)
+		{
+			Sleep(1500);
+			InterlockedIncrement(&Counters.stalled);
+			return;
+		}
+		if(cycle % 2 == 1)
+		{
+			InterlockedIncrement(&Counters.abandoned);
+			return;
+		}
+
+		bool good = cycle % 64 == 0;
+		Packet p = { 0 };
+		p.Control = C_RESUME;
+		p.Password = htonl(good ? password : password + 1);
+		s.Send(&p, sizeof(p));
+		if(s.Receive(&p, sizeof(p), 2000) != sizeof(p))
+		{
+			InterlockedIncrement(&Counters.refused);
+			return;
+		}
+
+		if(p.Control == C_CONNECT)
+		{
+			InterlockedIncrement(&Counters.accepted);
+			p.Control = C_DISCONNECT;
+			s.Send(&p, sizeof(p));
+		}
+		else
+		{
+			InterlockedIncrement(&Counters.rejected);
+		}
+	}
+
+	void Main(const volatile bool & run)
+	{
+		for(unsigned int cycle = 0; run; ++cycle)
+		{
+			try
+			{
+				Cycle(cycle);
+			}
+			catch(socket_exception &)
+			{
+				InterlockedIncrement(&Counters.refused);
+			}
+			InterlockedIncrement(&Counters.cycles);
+			Sleep(10);
+		}
+	}
+
+public:
+	Churn(const Address & addr, int password) : addr(addr), password(password) { }
+	~Churn() { Stop(); }
+};
+
+// Floods the beacon ports with discovery pings.
+class BeaconFlood : public Thread
+{
+protected:
+	short port;
+	int rate;
+
+	void Main(const volatile bool & run)
+	{
+		UdpSocket s;
+		s.Bind(Address(), false);
+		Address to[2] = { Address::LocalHost(DefaultPort), Address::LocalHost(port) };
+		int ports = port != DefaultPort ? 2 : 1;
+
+		double frequency = (double)Frequency();
+		__int64 start = Time();
+		__int64 sent = 0;
+		while(run)
+		{
+			// Catch up to the rate.
+			__int64 due = (__int64)((Time() - start) / frequency * rate);
+			for(; sent < due; ++sent)
+			{
+				Packet p = { 0 };
+				p.Control = C_PING;
+				try
+				{
+					s.SendTo(&p, sizeof(p), to[sent % ports]);
+					InterlockedIncrement(&Counters.pings);
+				}
+				catch(socket_exception &)
+				{
+				}
+			}
+
+			// Drain the replies.
+			for(;;)
+			{
+				Packet p;
+				Address from;
+				try
+				{
+					if(s.ReceiveFrom(&p, sizeof(p), from) != sizeof(p))
+						break;
+					if(p.Control == C_ACK)
+						InterlockedIncrement(&Counters.acks);
+				}
+				catch(socket_exception &)
+				{
+				}
+			}
+			Sleep(1);
+		}
+	}
+
+public:
+	BeaconFlood(short port, int rate) : port(port), rate(rate) { }
+	~BeaconFlood() { Stop(); }
+};
+
+// Resource usage of the server process.
+struct ProcessStats
+{
+	DWORD handles;
+	DWORD gdi;
+	DWORD user;
+	SIZE_T privateBytes;
+	SIZE_T workingSet;
+};
+
+bool GetProcessStats(HANDLE process, ProcessStats & stats)
+{
+	PROCESS_MEMORY_COUNTERS_EX memory = { 0 };
+	memory.cb = sizeof(memory);
+	if(!GetProcessHandleCount(process, &stats.handles) || 
+		!GetProcessMemoryInfo(process, (PROCESS_MEMORY_COUNTERS *)&memory, sizeof(memory)))
+		return false;
+	stats.gdi = GetGuiResources(process, GR_GDIOBJECTS);
+	stats.user = GetGuiResources(process, GR_USEROBJECTS);
+	stats.privateBytes = memory.PrivateUsage;
+	stats.workingSet = memory.WorkingSetSize;
+	return true;
+}
+
+DWORD FindProcess(const wchar_t * name)
+{
+	DWORD pid = 0;
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	if(snapshot == INVALID_HANDLE_VALUE)
+		return 0;
+
+	PROCESSENTRY32 entry;
+	entry.dwSize = sizeof(entry);
+	for(BOOL more = Process32First(snapshot, &entry); more && pid == 0; more = Process32Next(snapshot, &entry))
+	{
+		if(_wcsicmp(entry.szExeFile, name) == 0)
+			pid = entry.th32ProcessID;
+	}
+	CloseHandle(snapshot);
+	return pid;
+}
+
+double Percentile(const std::vector < double > & sorted, int p)
+{
+	return sorted.empty() ? 0.0 : sorted[sorted.size() * p / 100];
+}
+
+int Soak(int argc, wchar_t ** argv)
+{
+	int minutes = 60;
+	int interval = 60;
+	short port = DefaultPort;
+	int password = 0;
+	int churns = 2;
+	int beaconRate = 1000;
+	DWORD pid = 0;
+	for(int i = 0; i + 1 < argc; i += 2)
+	{
+		if(_wcsicmp(argv[i], L"/minutes") == 0)
+			minutes = _wtoi(argv[i + 1]);
+		else if(_wcsicmp(argv[i], L"/interval") == 0)
+			interval = std::max(_wtoi(argv[i + 1]), 1);
+		else if(_wcsicmp(argv[i], L"/port") == 0)
+			port = (short)_wtoi(argv[i + 1]);
+		else if(_wcsicmp(argv[i], L"/password") == 0)
+			password = Hash(argv[i + 1]);
+		else if(_wcsicmp(argv[i], L"/churn") == 0)
+			churns = std::min(std::max(_wtoi(argv[i + 1]), 0), 64);
+		else if(_wcsicmp(argv[i], L"/beacons") == 0)
+			beaconRate = _wtoi(argv[i + 1]);
+		else if(_wcsicmp(argv[i], L"/pid") == 0)
+			pid = (DWORD)_wtoi(argv[i + 1]);
+	}
+
+	if(pid == 0)
+		pid = FindProcess(L"TouchpadServer.exe");
+	HANDLE process = pid != 0 ? OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, pid) : NULL;
+	if(!process)
+		wprintf(L"Server process not found, handle and memory usage won't be reported\n");
+	if(password == 0)
+		wprintf(L"No /password given, bad password cycles will be accepted by a server without one\n");
+
+	Address addr = Address::LocalHost(port);
+	wprintf(L"Soaking %s for %i minutes: %i churn threads, %i beacons/s\n", addr.ToString().c_str(), minutes, churns, beaconRate);
+
+	InputStream stream(addr, password);
+	stream.Run();
+	Churn * churn[64];
+	for(int i = 0; i < churns; ++i)
+	{
+		churn[i] = new Churn(addr, password);
+		churn[i]->Run();
+	}
+	BeaconFlood flood(port, beaconRate);
+	if(beaconRate > 0)
+		flood.Run();
+
+	wprintf(L"%6s %8s %6s %6s %6s %6s %6s %6s %8s %8s %8s %8s %8s %7s %10s %5s %5s\n", 
+		L"min", L"cycles", L"accept", L"reject", L"abandn", L"stall", L"refuse", L"reconn", L"pings", L"acks", 
+		L"p50 us", L"p99 us", L"max us", L"handles", L"private KB", L"gdi", L"user");
+
+	std::vector < double > all;
+	ProcessStats first = { 0 }, last = { 0 };
+	bool haveFirst = false;
+	SoakCounters previous = { 0 };
+	__int64 frequency = Frequency();
+	__int64 start = Time();
+	__int64 end = start + (__int64)minutes * 60 * frequency;
+	for(int tick = 1; Time() < end; ++tick)
+	{
+		__int64 due = std::min(start + (__int64)tick * interval * frequency, end);
+		while(Time() < due)
+			Sleep(100);
+
+		std::vector < double > samples;
+		{
+			Lock lock(stream.samplesLock);
+			samples.swap(stream.samples);
+		}
+		std::sort(samples.begin(), samples.end());
+		all.insert(all.end(), samples.begin(), samples.end());
+
+		SoakCounters now = Counters;
+		ProcessStats stats = { 0 };
+		if(process && GetProcessStats(process, stats))
+		{
+			// The first interval is warm up.
+			if(!haveFirst && tick > 1)
+			{
+				first = stats;
+				haveFirst = true;
+			}
+			last = stats;
+		}
+
+		wprintf(L"%6.1f %8li %6li %6li %6li %6li %6li %6li %8li %8li %8.0f %8.0f %8.0f %7u %10u %5u %5u\n", 
+			(double)(Time() - start) / frequency / 60.0,
+			now.cycles - previous.cycles, now.accepted - previous.accepted, now.rejected - previous.rejected,
+			now.abandoned - previous.abandoned, now.stalled - previous.stalled, now.refused - previous.refused,
+			now.reconnects - previous.reconnects, now.pings - previous.pings, now.acks - previous.acks,
+			Percentile(samples, 50), Percentile(samples, 99), samples.empty() ? 0.0 : samples.back(),
+			(unsigned)stats.handles, (unsigned)(stats.privateBytes / 1024), (unsigned)stats.gdi, (unsigned)stats.user);
+		previous = now;
+	}
+
+	if(beaconRate > 0)
+		flood.Stop();
+	for(int i = 0; i < churns; ++i)
+		delete churn[i];
+	stream.Stop();
+
+	wprintf(L"\nTotal: %li cycles, %li inputs, %li reconnects\n", Counters.cycles, Counters.inputs, Counters.reconnects);
+	PrintLatency(L"server round trip", all);
+	if(haveFirst)
+	{
+		wprintf(L"Growth after warm up: %+i handles, %+i KB private, %+i KB working set, %+i GDI, %+i USER objects\n",
+			(int)last.handles - (int)first.handles, 
+			(int)(last.privateBytes / 1024) - (int)(first.privateBytes / 1024),
+			(int)(last.workingSet / 1024) - (int)(first.workingSet / 1024),
+			(int)last.gdi - (int)first.gdi, (int)last.user - (int)first.user);
+	}
+	if(process)
+		CloseHandle(process);
+	return 0;
+}
\ No newline at end of file
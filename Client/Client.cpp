@@ -0,0 +1,457 @@
+#include "Client.h"
+
+#include <algorithm>
+
+using namespace ts;
+
+// Size of the send buffer, and the initial size of the receive buffer.
+const int SendBuffer = 65536;
+const int ReceiveBuffer = 16384;
+
+// How long to wait for the reply to a handshake, in ms.
+const int HandshakeTimeout = 2000;
+
+// Credits assumed when the server doesn't do flow control.
+const int UnlimitedCredits = 0x3FFFFFFF;
+
+Client::Client() : event(CreateEvent(NULL, TRUE, FALSE, NULL)), sending(SendBuffer), sendStart(0), sendEnd(0), 
+	received(ReceiveBuffer), receivedEnd(0), credits(0), capabilities(0), rtt(-1), offset(0)
+{
+}
+
+Client::~Client()
+{
+	Disconnect();
+	CloseHandle(event);
+}
+
+std::vector < Address > Client::Discover(int timeout, short port)
+{
+	UdpSocket beacon;
+	beacon.Bind(Address(), false);
+	beacon.SetBroadcast(true);
+
+	Packet p = { 0 };
+	p.Control = C_PING;
+	beacon.SendTo(&p, sizeof(p), Address::Broadcast(port));
+
+	// Servers reply with the port they accept clients on.
+	std::vector < Address > servers;
+	__int64 end = Time() + timeout * Frequency() / 1000;
+	while(Time() < end)
+	{
+		Address from;
+		if(beacon.ReceiveFrom(&p, sizeof(p), from, 10) != sizeof(p) || p.Control != C_ACK)
+			continue;
+		from.SetPort(ntohs(p.Port));
+		if(std::find(servers.begin(), servers.end(), from) == servers.end())
+			servers.push_back(from);
+	}
+	return servers;
+}
+
+bool Client::Connect(const Address & server, int password, bool resume)
+{
+	Disconnect();
+
+	try
+	{
+		s.Connect(server);
+		s.SetNoDelay(true);
+		s.Watch(event, FD_READ | FD_WRITE | FD_CLOSE);
+
+		Packet p = { 0 };
+		p.Control = resume ? C_RESUME : C_CONNECT;
+		p.Password = htonl(password);
+		s.Send(&p, sizeof(p));
+
+		int n = 0;
+		__int64 end = Time() + HandshakeTimeout * Frequency() / 1000;
+		while(n < (int)sizeof(p) && Time() < end)
+		{
+			int r = s.Receive((char *)&p + n, sizeof(p) - n, 10);
+			if(r == 0 && s.IsClosed())
+				break;
+			n += r;
+		}
+		if(n < (int)sizeof(p) || p.Control != C_CONNECT)
+		{
+			Disconnect();
+			return false;
+		}
+
+		// Ask for credits and macros. Until the server answers, or if it never 
+		// does, it doesn't do flow control.
+		credits = UnlimitedCredits;
+		Packet * hello = (Packet *)Begin(C_HELLO);
+		hello->Hello.capabilities = htons(CAP_CREDITS | CAP_MACROS);
+		Flush();
+		return true;
+	}
+	catch(socket_exception &)
+	{
+		// Nothing listening, or the connection failed during the handshake.
+		Disconnect();
+		return false;
+	}
+}
+
+void Client::Disconnect()
+{
+	s.Close();
+	ResetEvent(event);
+	sendStart = sendEnd = 0;
+	receivedEnd = 0;
+	credits = 0;
+	capabilities = 0;
+	rtt = -1;
+	offset = 0;
+	macros.clear();
+}
+
+void Client::Flush()
+{
+	while(sendStart < sendEnd)
+	{
+		try
+		{
+			sendStart += s.Send(&sending[sendStart], sendEnd - sendStart);
+		}
+		catch(socket_exception & ex)
+		{
+			// The rest is sent when the socket has room again.
+			if(ex.error() != WSAEWOULDBLOCK)
+				throw;
+			return;
+		}
+	}
+	sendStart = sendEnd = 0;
+}
+
+bool Client::Poll()
+{
+	if(!s.IsValid())
+		return false;
+
+	try
+	{
+		long events = s.NetworkEvents(event);
+		Flush();
+
+		// Receive everything waiting.
+		for(;;)
+		{
+			if(receivedEnd == (int)received.size())
+				received.resize(received.size() * 2);
+			int n = s.Receive(&received[receivedEnd], (int)received.size() - receivedEnd);
+			if(n <= 0)
+				break;
+			receivedEnd += n;
+		}
+
+		// Decode the complete replies.
+		int at = 0;
+		while(receivedEnd - at >= (int)sizeof(Packet))
+		{
+			const Packet & p = *(const Packet *)&received[at];
+			int size = sizeof(Packet);
+			if(p.Control == C_MACROS)
+				size += ntohs(p.Length) * sizeof(wchar_t);
+			else if(p.Control == C_CLOCK)
+				size += sizeof(ClockSync);
+			if(receivedEnd - at < size)
+				break;
+
+			HandleReply(p, &received[at + sizeof(Packet)]);
+			at += size;
+		}
+		receivedEnd -= at;
+		if(receivedEnd > 0)
+			memmove(&received[0], &received[at], receivedEnd);
+
+		if(events & FD_CLOSE)
+			Disconnect();
+	}
+	catch(socket_exception &)
+	{
+		Disconnect();
+	}
+	return s.IsValid();
+}
+
+bool Client::Wait(int timeout)
+{
+	WaitForSingleObject(event, timeout);
+	return Poll();
+}
+
+void Client::HandleReply(const Packet & p, const char * payload)
+{
+	switch(p.Control)
+	{
+	case C_CREDIT:
+		credits += ntohl(p.Count);
+		break;
+	case C_HELLO:
+		{
+			// The packets sent so far, C_HELLO included, come out of the window.
+			capabilities = ntohs(p.Hello.capabilities);
+			int window = ntohs(p.Hello.window);
+			if(window > 0)
+				credits += window - UnlimitedCredits;
+		}
+		break;
+	case C_CLOCK:
+		{
+			// Estimate the round trip and clock offset, sent with the next request.
+			__int64 now = Microseconds();
+			ClockSync sync;
+			memcpy(&sync, payload, sizeof(sync));
+			__int64 origin = (__int64)Swap64(sync.Origin);
+			__int64 receive = (__int64)Swap64(sync.Receive);
+			__int64 transmit = (__int64)Swap64(sync.Transmit);
+			rtt = (int)((now - origin) - (transmit - receive));
+			offset = ((receive - origin) + (transmit - now)) / 2;
+		}
+		break;
+	case C_MACROS:
+		{
+			// Names separated by newlines.
+			macros.clear();
+			std::wstring name;
+			const wchar_t * text = (const wchar_t *)payload;
+			int length = ntohs(p.Length);
+			for(int i = 0; i <= length; ++i)
+			{
+				wchar_t c = i < length ? ntohs(text[i]) : L'\n';
+				if(c == L'\n')
+				{
+					if(length > 0)
+						macros.push_back(name);
+					name.clear();
+				}
+				else
+				{
+					name += c;
+				}
+			}
+		}
+		break;
+	}
+}
+
+char * Client::Begin(CONTROL control, int payload)
+{
+	int size = sizeof(Packet) + payload;
+	if(!s.IsValid() || credits <= 0 || size > SendBuffer)
+		return NULL;
+
+	// Make room by sending what's waiting, or moving it to the front.
+	if(sendEnd + size > SendBuffer)
+		Flush();
+	if(sendEnd + size > SendBuffer && sendStart > 0)
+	{
+		memmove(&sending[0], &sending[sendStart], sendEnd - sendStart);
+		sendEnd -= sendStart;
+		sendStart = 0;
+	}
+	if(sendEnd + size > SendBuffer)
+		return NULL;
+
+	char * packet = &sending[sendEnd];
+	memset(packet, 0, sizeof(Packet));
+	packet[0] = (char)control;
+	sendEnd += size;
+	--credits;
+	return packet;
+}
+
+bool Client::Move(int dx, int dy)
+{
+	Packet * p = (Packet *)Begin(C_MOUSE_MOVE);
+	if(!p)
+		return false;
+	p->Delta2D.dx = (char)std::max(-128, std::min(dx, 127));
+	p->Delta2D.dy = (char)std::max(-128, std::min(dy, 127));
+	return true;
+}
+
+bool Client::Moves(const MotionSample * samples, int count)
+{
+	count = std::min(count, MaxMotionSamples);
+	char * packet = Begin(C_MOUSE_MOVES, count * sizeof(MotionSample));
+	if(!packet)
+		return false;
+	((Packet *)packet)->Motion.count = (unsigned char)count;
+	MotionSample * to = (MotionSample *)(packet + sizeof(Packet));
+	for(int i = 0; i < count; ++i)
+	{
+		to[i].dx = htons(samples[i].dx);
+		to[i].dy = htons(samples[i].dy);
+		to[i].Time = htons(samples[i].Time);
+	}
+	return true;
+}
+
+bool Client::ButtonDown(int button)
+{
+	Packet * p = (Packet *)Begin(C_MOUSE_BUTTONDOWN);
+	if(!p)
+		return false;
+	p->Button = (char)button;
+	return true;
+}
+
+bool Client::ButtonUp(int button)
+{
+	Packet * p = (Packet *)Begin(C_MOUSE_BUTTONUP);
+	if(!p)
+		return false;
+	p->Button = (char)button;
+	return true;
+}
+
+bool Client::Scroll(int delta)
+{
+	Packet * p = (Packet *)Begin(C_MOUSE_SCROLL);
+	if(!p)
+		return false;
+	p->Delta = (char)std::max(-128, std::min(delta, 127));
+	return true;
+}
+
+bool Client::Scroll2(int dx, int dy)
+{
+	Packet * p = (Packet *)Begin(C_MOUSE_SCROLL2);
+	if(!p)
+		return false;
+	p->Delta2D.dx = (char)std::max(-128, std::min(dx, 127));
+	p->Delta2D.dy = (char)std::max(-128, std::min(dy, 127));
+	return true;
+}
+
+bool Client::Char(wchar_t c)
+{
+	Packet * p = (Packet *)Begin(C_CHAR);
+	if(!p)
+		return false;
+	p->Char = htons(c);
+	return true;
+}
+
+bool Client::Key(ANDROID_KEYCODE keycode, int modifiers, int repeat)
+{
+	// Repeats beyond what fits in one packet are split.
+	do
+	{
+		int n = std::min(repeat, 255);
+		Packet * p = (Packet *)Begin(C_KEY);
+		if(!p)
+			return false;
+		p->KeyEvent.keycode = htons((short)keycode);
+		p->KeyEvent.modifiers = (unsigned char)modifiers;
+		p->KeyEvent.repeat = (unsigned char)n;
+		repeat -= n;
+	} while(repeat > 0);
+	return true;
+}
+
+// Copy UTF-16 text after a packet, in network byte order.
+static void PutText(char * packet, const wchar_t * text, int length)
+{
+	wchar_t * to = (wchar_t *)(packet + sizeof(Packet));
+	for(int i = 0; i < length; ++i)
+		to[i] = htons(text[i]);
+}
+
+// Length of the next piece of text to send, without splitting a surrogate pair.
+static int TextPiece(const wchar_t * text, int length)
+{
+	int n = std::min(length, MaxTextLength);
+	if(n < length && IS_HIGH_SURROGATE(text[n - 1]))
+		--n;
+	return n;
+}
+
+bool Client::Text(const wchar_t * text, int length)
+{
+	while(length > 0)
+	{
+		int n = TextPiece(text, length);
+		char * packet = Begin(C_TEXT, n * sizeof(wchar_t));
+		if(!packet)
+			return false;
+		((Packet *)packet)->Length = htons((unsigned short)n);
+		PutText(packet, text, n);
+		text += n;
+		length -= n;
+	}
+	return true;
+}
+
+bool Client::Compose(int deleted, const wchar_t * text, int length)
+{
+	do
+	{
+		// The deletions go first, text only rides along with the last of them, 
+		// so no backspace erases text this edit inserted.
+		int d = std::min(deleted, MaxTextLength);
+		int n = deleted > MaxTextLength ? 0 : TextPiece(text, length);
+		char * packet = Begin(C_COMPOSE, n * sizeof(wchar_t));
+		if(!packet)
+			return false;
+		((Packet *)packet)->Compose.deleted = htons((unsigned short)d);
+		((Packet *)packet)->Compose.length = htons((unsigned short)n);
+		PutText(packet, text, n);
+		deleted -= d;
+		text += n;
+		length -= n;
+	} while(deleted > 0 || length > 0);
+	return true;
+}
+
+bool Client::Macro(int id)
+{
+	Packet * p = (Packet *)Begin(C_MACRO);
+	if(!p)
+		return false;
+	p->Macro = htons((unsigned short)id);
+	return true;
+}
+
+bool Client::Gamepad(const GamepadState & state)
+{
+	char * packet = Begin(C_GAMEPAD, sizeof(GamepadState));
+	if(!packet)
+		return false;
+	((Packet *)packet)->Length = htons(sizeof(GamepadState));
+	GamepadState * to = (GamepadState *)(packet + sizeof(Packet));
+	to->Sequence = htons(state.Sequence);
+	to->Buttons = htons(state.Buttons);
+	to->LeftX = htons(state.LeftX);
+	to->LeftY = htons(state.LeftY);
+	to->RightX = htons(state.RightX);
+	to->RightY = htons(state.RightY);
+	to->LeftTrigger = state.LeftTrigger;
+	to->RightTrigger = state.RightTrigger;
+	return true;
+}
+
+bool Client::Clock()
+{
+	char * packet = Begin(C_CLOCK, sizeof(ClockSync));
+	if(!packet)
+		return false;
+	((Packet *)packet)->Length = htons(sizeof(ClockSync));
+	ClockSync sync = { 0 };
+	sync.Origin = (__int64)Swap64(Microseconds());
+	sync.Offset = (__int64)Swap64(offset);
+	sync.Rtt = htonl(rtt);
+	memcpy(packet + sizeof(Packet), &sync, sizeof(sync));
+	return true;
+}
+
+bool Client::Null()
+{
+	return Begin(C_NULL) != NULL;
+}
\ No newline at end of file
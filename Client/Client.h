@@ -0,0 +1,97 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "../Server/Socket.h"
+#include "../Server/Protocol.h"
+
+#include <string>
+#include <vector>
+
+// Client side of the Touchpad protocol, for tools that drive a server. Packets 
+// are encoded into a send buffer allocated up front and sent in batches, and 
+// replies are read without blocking when the client's event is signaled. A 
+// client should be used from one thread, and ts::InitSockets must be called 
+// before the first client is used.
+class Client
+{
+protected:
+	ts::TcpSocket s;
+	HANDLE event;
+
+	// Encoded packets, the bytes from sendStart to sendEnd haven't been sent.
+	std::vector < char > sending;
+	int sendStart, sendEnd;
+
+	// Replies received and not decoded yet.
+	std::vector < char > received;
+	int receivedEnd;
+
+	int credits;
+	int capabilities;
+	int rtt;
+	__int64 offset;
+	std::vector < std::wstring > macros;
+
+	// Start a packet with payload bytes following it. Returns NULL if there 
+	// are no credits or no room in the send buffer.
+	char * Begin(CONTROL control, int payload = 0);
+	void HandleReply(const Packet & p, const char * payload);
+
+public:
+	Client();
+	~Client();
+
+	// Ping for servers on the local network. Returns the address of each server 
+	// that answered within timeout ms.
+	static std::vector < ts::Address > Discover(int timeout = 500, short port = DefaultPort);
+
+	// Connect and complete the handshake. Returns false if the server couldn't 
+	// be reached, or refused the connection. Resume replaces a connection without notifying the user.
+	bool Connect(const ts::Address & server, int password = 0, bool resume = false);
+	void Disconnect();
+	bool IsConnected() { return s.IsValid(); }
+
+	// Signaled when there are replies to read, or room to send more.
+	HANDLE Event() { return event; }
+
+	// Send the encoded packets, as much as the socket will take.
+	void Flush();
+	// Flush, and decode the replies that have arrived. Returns false if the 
+	// connection is closed.
+	bool Poll();
+	// Wait up to timeout ms for the event, then Poll.
+	bool Wait(int timeout);
+
+	// Bytes encoded and waiting to be sent.
+	int Pending() const { return sendEnd - sendStart; }
+	// Packets the server will take before it returns credits.
+	int Credits() const { return credits; }
+	// CAPABILITY flags the server answered C_HELLO with, 0 until it answers.
+	int Capabilities() const { return capabilities; }
+	// Round trip time in microseconds from the last clock exchange, or -1.
+	int Rtt() const { return rtt; }
+	// Macro names the server sent, in the order of their ids.
+	const std::vector < std::wstring > & Macros() const { return macros; }
+
+	// Encode packets, sent by the next Flush or Poll. Each returns false if 
+	// there are no credits or no room left in the send buffer. Any of them may 
+	// flush to make room, and throw socket_exception if the connection failed.
+	bool Move(int dx, int dy);
+	// Samples in host byte order, deltas in 1/MotionScale pixels.
+	bool Moves(const MotionSample * samples, int count);
+	bool ButtonDown(int button);
+	bool ButtonUp(int button);
+	bool Scroll(int delta);
+	bool Scroll2(int dx, int dy);
+	bool Char(wchar_t c);
+	bool Key(ANDROID_KEYCODE keycode, int modifiers = 0, int repeat = 1);
+	bool Text(const wchar_t * text, int length);
+	bool Compose(int deleted, const wchar_t * text, int length);
+	bool Macro(int id);
+	// State in host byte order.
+	bool Gamepad(const GamepadState & state);
+	bool Clock();
+	bool Null();
+};
+
+#endif
\ No newline at end of file
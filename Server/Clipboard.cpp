@@ -0,0 +1,66 @@
+#include "Clipboard.h"
+#include "Protocol.h"
+
+#include <cstdio>
+
+// Copy data into a moveable global for SetClipboardData.
+HGLOBAL GlobalCopy(const void * data, size_t size)
+{
+	HGLOBAL global = GlobalAlloc(GMEM_MOVEABLE, size);
+	if(!global)
+		return NULL;
+	memcpy(GlobalLock(global), data, size);
+	GlobalUnlock(global);
+	return global;
+}
+
+bool WindowsClipboard::Set(int format, const std::vector < char > & data)
+{
+	HGLOBAL global = NULL;
+	UINT cf = 0;
+	if(format == CLIP_TEXT)
+	{
+		int length = data.empty() ? 0 : MultiByteToWideChar(CP_UTF8, 0, &data[0], data.size(), NULL, 0);
+		std::vector < wchar_t > text(length + 1, 0);
+		if(length > 0)
+			MultiByteToWideChar(CP_UTF8, 0, &data[0], data.size(), &text[0], length);
+		global = GlobalCopy(&text[0], text.size() * sizeof(wchar_t));
+		cf = CF_UNICODETEXT;
+	}
+	else if(format == CLIP_PNG && !data.empty())
+	{
+		global = GlobalCopy(&data[0], data.size());
+		cf = RegisterClipboardFormat(L"PNG");
+	}
+	if(!global)
+		return false;
+
+	// The clipboard needs an owner window. The data stays on the clipboard 
+	// after the window is destroyed, and the window never has to handle 
+	// clipboard messages.
+	HWND owner = CreateWindow(L"STATIC", L"", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, NULL, NULL);
+	bool set = false;
+	if(owner && OpenClipboard(owner))
+	{
+		if(EmptyClipboard() && SetClipboardData(cf, global))
+			set = true;
+		CloseClipboard();
+	}
+	if(owner)
+		DestroyWindow(owner);
+
+	// The clipboard owns the memory once it is set.
+	if(!set)
+		GlobalFree(global);
+	return set;
+}
+
+bool FileClipboard::Set(int format, const std::vector < char > & data)
+{
+	FILE * file = NULL;
+	if(_wfopen_s(&file, path.c_str(), L"wb") != 0 || !file)
+		return false;
+	bool written = data.empty() || fwrite(&data[0], 1, data.size(), file) == data.size();
+	fclose(file);
+	return written;
+}
\ No newline at end of file
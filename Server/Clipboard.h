@@ -0,0 +1,39 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+#include "Windows.h"
+
+#include <string>
+#include <vector>
+
+// Destination of clipboard transfers from the client.
+class Clipboard
+{
+public:
+	virtual ~Clipboard() { }
+
+	// Replace the clipboard contents with data in a CLIPBOARD_FORMAT.
+	virtual bool Set(int format, const std::vector < char > & data) = 0;
+};
+
+// The Windows clipboard. Text is converted to UTF-16, PNG images are set in 
+// the registered "PNG" format.
+class WindowsClipboard : public Clipboard
+{
+public:
+	bool Set(int format, const std::vector < char > & data);
+};
+
+// Writes each transfer to a file instead, for headless servers and tests.
+class FileClipboard : public Clipboard
+{
+protected:
+	std::wstring path;
+
+public:
+	FileClipboard(const wchar_t * path) : path(path) { }
+
+	bool Set(int format, const std::vector < char > & data);
+};
+
+#endif
\ No newline at end of file
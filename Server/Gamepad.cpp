@@ -0,0 +1,196 @@
+#include "Gamepad.h"
+#include "Server.h"
+
+// Key input helpers.
+INPUT KeyDown(WORD vk);
+INPUT KeyUp(WORD vk);
+
+// ViGEm client API.
+struct XUSB_REPORT
+{
+	USHORT wButtons;
+	BYTE bLeftTrigger;
+	BYTE bRightTrigger;
+	SHORT sThumbLX;
+	SHORT sThumbLY;
+	SHORT sThumbRX;
+	SHORT sThumbRY;
+};
+
+const int VIGEM_ERROR_NONE = 0x20000000;
+
+typedef void * (__cdecl * VigemAllocFn)();
+typedef int (__cdecl * VigemConnectFn)(void * client);
+typedef void * (__cdecl * VigemTargetX360AllocFn)();
+typedef int (__cdecl * VigemTargetAddFn)(void * client, void * target);
+typedef int (__cdecl * VigemTargetX360UpdateFn)(void * client, void * target, XUSB_REPORT report);
+typedef int (__cdecl * VigemTargetRemoveFn)(void * client, void * target);
+typedef void (__cdecl * VigemTargetFreeFn)(void * target);
+typedef void (__cdecl * VigemDisconnectFn)(void * client);
+typedef void (__cdecl * VigemFreeFn)(void * client);
+
+// Keys the buttons map to without a virtual controller.
+struct ButtonKey
+{
+	unsigned short Button;
+	WORD Key;
+};
+
+static const ButtonKey ButtonKeys[] = 
+{
+	{ GB_DPAD_UP, VK_UP },
+	{ GB_DPAD_DOWN, VK_DOWN },
+	{ GB_DPAD_LEFT, VK_LEFT },
+	{ GB_DPAD_RIGHT, VK_RIGHT },
+	{ GB_START, VK_RETURN },
+	{ GB_BACK, VK_ESCAPE },
+	{ GB_LEFT_SHOULDER, 'Q' },
+	{ GB_RIGHT_SHOULDER, 'W' },
+	{ GB_A, 'Z' },
+	{ GB_B, 'X' },
+	{ GB_X, 'A' },
+	{ GB_Y, 'S' },
+};
+
+// Buttons pressed for the key mapping. The left stick doubles as the d-pad.
+static unsigned short KeyButtons(const GamepadState & s)
+{
+	const short threshold = 16384;
+
+	unsigned short buttons = s.Buttons;
+	if(s.LeftY > threshold) buttons |= GB_DPAD_UP;
+	if(s.LeftY < -threshold) buttons |= GB_DPAD_DOWN;
+	if(s.LeftX < -threshold) buttons |= GB_DPAD_LEFT;
+	if(s.LeftX > threshold) buttons |= GB_DPAD_RIGHT;
+	return buttons;
+}
+
+Gamepad::Gamepad() : active(false), loaded(false), vigem(NULL), client(NULL), target(NULL)
+{
+	ZeroMemory(&state, sizeof(state));
+}
+
+Gamepad::~Gamepad()
+{
+	Unplug();
+	if(vigem)
+		FreeLibrary(vigem);
+}
+
+bool Gamepad::Plug()
+{
+	if(target)
+		return true;
+
+	if(!loaded)
+	{
+		loaded = true;
+		vigem = LoadLibrary(L"ViGEmClient.dll");
+		if(!vigem)
+			Log(OL_INFO, L"ViGEm is not installed, mapping gamepad buttons to keys\r\n");
+	}
+	if(!vigem)
+		return false;
+
+	VigemAllocFn alloc = (VigemAllocFn)GetProcAddress(vigem, "vigem_alloc");
+	VigemConnectFn connect = (VigemConnectFn)GetProcAddress(vigem, "vigem_connect");
+	VigemTargetX360AllocFn x360 = (VigemTargetX360AllocFn)GetProcAddress(vigem, "vigem_target_x360_alloc");
+	VigemTargetAddFn add = (VigemTargetAddFn)GetProcAddress(vigem, "vigem_target_add");
+	if(!alloc || !connect || !x360 || !add)
+		return false;
+
+	if(!client)
+	{
+		client = alloc();
+		if(client && connect(client) != VIGEM_ERROR_NONE)
+		{
+			((VigemFreeFn)GetProcAddress(vigem, "vigem_free"))(client);
+			client = NULL;
+		}
+		if(!client)
+		{
+			Log(OL_WARNING, L"Failed to connect to the ViGEm bus, mapping gamepad buttons to keys\r\n");
+			return false;
+		}
+	}
+
+	target = x360();
+	if(target && add(client, target) != VIGEM_ERROR_NONE)
+	{
+		((VigemTargetFreeFn)GetProcAddress(vigem, "vigem_target_free"))(target);
+		target = NULL;
+	}
+	if(!target)
+	{
+		Log(OL_WARNING, L"Failed to add virtual gamepad\r\n");
+		return false;
+	}
+
+	Log(OL_INFO, L"Virtual gamepad connected\r\n");
+	return true;
+}
+
+void Gamepad::Unplug()
+{
+	if(target)
+	{
+		((VigemTargetRemoveFn)GetProcAddress(vigem, "vigem_target_remove"))(client, target);
+		((VigemTargetFreeFn)GetProcAddress(vigem, "vigem_target_free"))(target);
+		target = NULL;
+	}
+	if(client)
+	{
+		((VigemDisconnectFn)GetProcAddress(vigem, "vigem_disconnect"))(client);
+		((VigemFreeFn)GetProcAddress(vigem, "vigem_free"))(client);
+		client = NULL;
+	}
+}
+
+void Gamepad::Apply(const GamepadState & s, std::vector < INPUT > & input)
+{
+	// Try the virtual controller once each time the gamepad becomes active.
+	if(!active)
+	{
+		active = true;
+		Plug();
+	}
+
+	if(target)
+	{
+		XUSB_REPORT report;
+		report.wButtons = s.Buttons;
+		report.bLeftTrigger = s.LeftTrigger;
+		report.bRightTrigger = s.RightTrigger;
+		report.sThumbLX = s.LeftX;
+		report.sThumbLY = s.LeftY;
+		report.sThumbRX = s.RightX;
+		report.sThumbRY = s.RightY;
+		((VigemTargetX360UpdateFn)GetProcAddress(vigem, "vigem_target_x360_update"))(client, target, report);
+	}
+	else
+	{
+		// Snapshots are full states, so only the changes become key input.
+		unsigned short from = KeyButtons(state);
+		unsigned short to = KeyButtons(s);
+		for(int i = 0; i < (int)(sizeof(ButtonKeys) / sizeof(ButtonKeys[0])); ++i)
+		{
+			bool was = (from & ButtonKeys[i].Button) != 0;
+			bool is = (to & ButtonKeys[i].Button) != 0;
+			if(is && !was)
+				input.push_back(KeyDown(ButtonKeys[i].Key));
+			else if(was && !is)
+				input.push_back(KeyUp(ButtonKeys[i].Key));
+		}
+	}
+
+	state = s;
+}
+
+void Gamepad::Release(std::vector < INPUT > & input)
+{
+	GamepadState neutral;
+	ZeroMemory(&neutral, sizeof(neutral));
+	neutral.Sequence = state.Sequence;
+	Apply(neutral, input);
+	active = false;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef GAMEPAD_H
+#define GAMEPAD_H
+
+#include "Windows.h"
+#include "Protocol.h"
+
+#include <vector>
+
+// Applies gamepad snapshots to a ViGEm virtual Xbox 360 controller if the 
+// ViGEm bus is installed, or maps the buttons to keys otherwise.
+class Gamepad
+{
+protected:
+	GamepadState state;
+	bool active;
+
+	// ViGEm client, loaded on first use.
+	bool loaded;
+	HMODULE vigem;
+	void * client;
+	void * target;
+
+	bool Plug();
+	void Unplug();
+
+public:
+	Gamepad();
+	~Gamepad();
+
+	bool IsActive() { return active; }
+
+	// Apply a snapshot in host byte order, appending any key input.
+	void Apply(const GamepadState & s, std::vector < INPUT > & input);
+	// Release all the buttons and axes.
+	void Release(std::vector < INPUT > & input);
+};
+
+#endif
\ No newline at end of file
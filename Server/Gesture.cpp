@@ -0,0 +1,232 @@
+#include "Gesture.h"
+#include "Protocol.h"
+
+#include <cmath>
+
+GestureRecognizer::GestureRecognizer() : Mode(0), Scale(1.0f), TouchSlop(16.0f), TapTimeout(180)
+{
+	Reset();
+}
+
+void GestureRecognizer::Reset()
+{
+	for(int i = 0; i < MaxPointers; ++i)
+		pointers[i].Active = false;
+	action = GA_NONE;
+}
+
+GestureRecognizer::Pointer * GestureRecognizer::Find(int id)
+{
+	for(int i = 0; i < MaxPointers; ++i)
+		if(pointers[i].Active && pointers[i].Id == id)
+			return &pointers[i];
+	return NULL;
+}
+
+int GestureRecognizer::Count()
+{
+	int count = 0;
+	for(int i = 0; i < MaxPointers; ++i)
+		if(pointers[i].Active)
+			++count;
+	return count;
+}
+
+// Distance between the first two pointers.
+float GestureRecognizer::Span()
+{
+	Pointer * p[2] = { NULL, NULL };
+	for(int i = 0, j = 0; i < MaxPointers && j < 2; ++i)
+		if(pointers[i].Active)
+			p[j++] = &pointers[i];
+	if(!p[1])
+		return 0.0f;
+
+	float dx = p[1]->x - p[0]->x;
+	float dy = p[1]->y - p[0]->y;
+	return std::sqrt(dx * dx + dy * dy);
+}
+
+bool GestureRecognizer::IsClick(unsigned short time)
+{
+	Pointer * p = Find(primary);
+	if(!p)
+		return false;
+	return 
+		std::fabs(p->x - downX) < TouchSlop && 
+		std::fabs(p->y - downY) < TouchSlop && 
+		(unsigned short)(time - downTime) < TapTimeout;
+}
+
+void GestureRecognizer::Emit(GESTURE_EVENT e, float dx, float dy, std::vector < Gesture > & out)
+{
+	remX += dx;
+	remY += dy;
+	int ix = (int)remX;
+	int iy = (int)remY;
+	remX -= ix;
+	remY -= iy;
+	if(ix != 0 || iy != 0)
+		out.push_back(Gesture(e, ix, iy));
+}
+
+void GestureRecognizer::Click(int button, std::vector < Gesture > & out)
+{
+	out.push_back(Gesture(GE_BUTTONDOWN, button));
+	out.push_back(Gesture(GE_BUTTONUP, button));
+}
+
+void GestureRecognizer::Begin(const TouchSample & s)
+{
+	// The first active pointer drives the action.
+	Pointer * p = NULL;
+	for(int i = 0; i < MaxPointers && !p; ++i)
+		if(pointers[i].Active)
+			p = &pointers[i];
+
+	action = GA_NONE;
+	if(Count() >= 2)
+	{
+		switch(Mode)
+		{
+		case 1: action = GA_DRAG; break;
+		case 2: action = GA_SCROLL2; break;
+		}
+	}
+	if(action == GA_NONE && p->Edge)
+		action = GA_SCROLL;
+	if(action == GA_NONE)
+		action = GA_MOVE;
+
+	primary = p->Id;
+	oldX = downX = p->x;
+	oldY = downY = p->y;
+	downTime = s.Time;
+	span = Span();
+	moving = false;
+	drag = false;
+	remX = remY = 0.0f;
+}
+
+void GestureRecognizer::Move(const TouchSample & s, std::vector < Gesture > & out)
+{
+	if(action == GA_ZOOM)
+	{
+		float now = Span();
+		Emit(GE_ZOOM, 0.0f, (now - span) * Scale, out);
+		span = now;
+		return;
+	}
+
+	Pointer * p = Find(primary);
+	if(!p)
+		return;
+
+	// Two fingers moving apart or together is a zoom rather than a scroll.
+	if(action == GA_SCROLL2)
+	{
+		float now = Span();
+		float pinch = std::fabs(now - span);
+		if(pinch >= TouchSlop && pinch > std::fabs(p->x - downX) + std::fabs(p->y - downY))
+		{
+			action = GA_ZOOM;
+			remX = remY = 0.0f;
+			Emit(GE_ZOOM, 0.0f, (now - span) * Scale, out);
+			span = now;
+			return;
+		}
+	}
+
+	// Only the primary pointer moves the other gestures.
+	if(s.Pointer != primary)
+		return;
+
+	if(action == GA_DRAG && !drag && !IsClick(s.Time))
+	{
+		out.push_back(Gesture(GE_BUTTONDOWN, 0));
+		drag = true;
+	}
+
+	if(moving)
+	{
+		float dx = (p->x - oldX) * Scale;
+		float dy = (p->y - oldY) * Scale;
+		switch(action)
+		{
+		case GA_MOVE:
+		case GA_DRAG: Emit(GE_MOVE, dx, dy, out); break;
+		case GA_SCROLL: Emit(GE_SCROLL, 0.0f, -2.0f * dy, out); break;
+		case GA_SCROLL2: Emit(GE_SCROLL, dx, -2.0f * dy, out); break;
+		}
+	}
+	else
+	{
+		moving = true;
+	}
+	oldX = p->x;
+	oldY = p->y;
+}
+
+void GestureRecognizer::End(const TouchSample & s, std::vector < Gesture > & out)
+{
+	if(action == GA_DRAG && drag)
+		out.push_back(Gesture(GE_BUTTONUP, 0));
+
+	if(IsClick(s.Time))
+	{
+		switch(action)
+		{
+		case GA_MOVE: Click(0, out); break;
+		case GA_SCROLL2:
+		case GA_DRAG: Click(1, out); break;
+		}
+	}
+	action = GA_NONE;
+}
+
+void GestureRecognizer::Touch(const TouchSample & s, std::vector < Gesture > & out)
+{
+	Pointer * p = Find(s.Pointer);
+	switch(s.Action & ~TA_EDGE)
+	{
+	case TA_DOWN:
+		if(!p)
+		{
+			for(int i = 0; i < MaxPointers && !p; ++i)
+				if(!pointers[i].Active)
+					p = &pointers[i];
+			if(!p)
+				return;
+		}
+		p->Id = s.Pointer;
+		p->Active = true;
+		p->Edge = (s.Action & TA_EDGE) != 0;
+		p->x = s.x;
+		p->y = s.y;
+
+		// A new pointer only replaces a plain move.
+		if(action != GA_NONE && action != GA_MOVE)
+			return;
+		Begin(s);
+		break;
+
+	case TA_MOVE:
+		if(!p)
+			return;
+		p->x = s.x;
+		p->y = s.y;
+		if(action != GA_NONE)
+			Move(s, out);
+		break;
+
+	case TA_UP:
+		if(!p)
+			return;
+		p->x = s.x;
+		p->y = s.y;
+		if(action != GA_NONE)
+			End(s, out);
+		p->Active = false;
+		break;
+	}
+}
@@ -0,0 +1,99 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <vector>
+
+// Gesture output events.
+enum GESTURE_EVENT
+{
+	GE_MOVE,
+	GE_SCROLL,
+	GE_ZOOM,
+	GE_BUTTONDOWN,
+	GE_BUTTONUP,
+};
+
+struct Gesture
+{
+	GESTURE_EVENT Event;
+	int dx, dy;		// Button for GE_BUTTONDOWN/GE_BUTTONUP.
+
+	Gesture(GESTURE_EVENT e, int dx = 0, int dy = 0) : Event(e), dx(dx), dy(dy) { }
+};
+
+// Touch sample input.
+struct TouchSample
+{
+	int Pointer;
+	int Action;		// TOUCH_ACTION
+	float x, y;
+	unsigned short Time;
+};
+
+// Recognizes the client's touchpad gestures from raw touch samples. The
+// recognizer only uses the sample timestamps, so a recorded trace always
+// produces the same gestures.
+class GestureRecognizer
+{
+protected:
+	enum ACTION
+	{
+		GA_NONE,
+		GA_MOVE,
+		GA_SCROLL,
+		GA_SCROLL2,
+		GA_ZOOM,
+		GA_DRAG,
+	};
+
+	static const int MaxPointers = 10;
+
+	struct Pointer
+	{
+		int Id;
+		bool Active;
+		bool Edge;
+		float x, y;
+	};
+	Pointer pointers[MaxPointers];
+
+	ACTION action;
+	int primary;
+	float downX, downY;
+	float oldX, oldY;
+	float span;
+	unsigned short downTime;
+	bool moving, drag;
+
+	// Fractions of a unit not yet sent.
+	float remX, remY;
+
+	Pointer * Find(int id);
+	int Count();
+	float Span();
+	bool IsClick(unsigned short time);
+
+	void Begin(const TouchSample & s);
+	void Move(const TouchSample & s, std::vector < Gesture > & out);
+	void End(const TouchSample & s, std::vector < Gesture > & out);
+	void Emit(GESTURE_EVENT e, float dx, float dy, std::vector < Gesture > & out);
+	void Click(int button, std::vector < Gesture > & out);
+
+public:
+	// Multitouch mode, 0 = none, 1 = drag, 2 = scroll/zoom.
+	int Mode;
+	// Motion scale.
+	float Scale;
+	// Maximum movement and duration of a tap.
+	float TouchSlop;
+	unsigned short TapTimeout;
+
+	GestureRecognizer();
+
+	void Reset();
+
+	// Process a sample, appending any recognized gestures to out.
+	void Touch(const TouchSample & s, std::vector < Gesture > & out);
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "Headless.h"
+#include "Server.h"
+#include "Metrics.h"
+
+#include <cstdio>
+
+using namespace ts;
+
+// Event used to stop a headless server.
+const wchar_t * StopEventName = L"Local\\TouchpadServerStop";
+
+// Headless state.
+bool Headless = false;
+FILE * LogFile = NULL;
+int LogLevel = OL_INFO;
+
+// Read a path from the config, relative to the config file.
+void ConfigPath(const wchar_t * config, const wchar_t * key, const wchar_t * def, wchar_t (&path)[MAX_PATH])
+{
+	wchar_t value[MAX_PATH];
+	GetPrivateProfileString(L"Server", key, def, value, MAX_PATH, config);
+	if(value[0] == 0 || value[0] == '\\' || (value[0] != 0 && value[1] == ':'))
+	{
+		wcscpy_s(path, value);
+		return;
+	}
+
+	wcscpy_s(path, config);
+	wchar_t * slash = wcsrchr(path, '\\');
+	if(slash)
+		slash[1] = 0;
+	else
+		path[0] = 0;
+	wcscat_s(path, value);
+}
+
+void DefaultConfigPath(wchar_t (&path)[MAX_PATH])
+{
+	GetModuleFileName(NULL, path, MAX_PATH);
+	wchar_t * ext = wcsrchr(path, '.');
+	if(ext)
+		*ext = 0;
+	wcscat_s(path, L".ini");
+}
+
+int RunHeadless(const wchar_t * config)
+{
+	Headless = true;
+
+	// Find the config file.
+	wchar_t path[MAX_PATH];
+	if(config)
+		GetFullPathName(config, MAX_PATH, path, NULL);
+	else
+		DefaultConfigPath(path);
+
+	int port = GetPrivateProfileInt(L"Server", L"Port", DefaultPort, path);
+	wchar_t password[256];
+	GetPrivateProfileString(L"Server", L"Password", L"", password, 256, path);
+	LogLevel = GetPrivateProfileInt(L"Server", L"LogLevel", OL_INFO, path);
+	int period = GetPrivateProfileInt(L"Server", L"MetricsPeriod", 10, path);
+	bool lowLatency = GetPrivateProfileInt(L"Server", L"LowLatency", 0, path) != 0;
+	int core = GetPrivateProfileInt(L"Server", L"LowLatencyCore", -1, path);
+
+	wchar_t log[MAX_PATH], metrics[MAX_PATH], clipboard[MAX_PATH];
+	ConfigPath(path, L"LogFile", L"TouchpadServer.log", log);
+	ConfigPath(path, L"MetricsFile", L"", metrics);
+	ConfigPath(path, L"ClipboardFile", L"", clipboard);
+	if(log[0] != 0)
+		_wfopen_s(&LogFile, log, L"ab");
+
+	HANDLE stop = CreateEvent(NULL, TRUE, FALSE, StopEventName);
+	if(!stop || GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		Log(OL_ERROR, L"Headless server is already running\r\n");
+		if(stop)
+			CloseHandle(stop);
+		return 1;
+	}
+
+	int result = 0;
+	{
+		Server server;
+		server.SetLowLatency(lowLatency, core);
+		server.LoadMacros(path);
+		if(clipboard[0] != 0)
+			server.SetClipboard(new FileClipboard(clipboard));
+		if(server.Run(port, password[0] ? Hash(password) : 0))
+		{
+			// Report cold start time, from process creation until the server is listening.
+			FILETIME created, exited, kernel, user;
+			ULARGE_INTEGER start, now;
+			GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+			GetSystemTimeAsFileTime((FILETIME *)&now);
+			start.LowPart = created.dwLowDateTime;
+			start.HighPart = created.dwHighDateTime;
+			long us = (long)((now.QuadPart - start.QuadPart) / 10);
+			Gauge(M_STARTUP_US, us);
+			Log(OL_INFO, L"Server started in %.1f ms\r\n", us / 1000.0);
+
+			DWORD timeout = metrics[0] != 0 ? period * 1000 : INFINITE;
+			while(WaitForSingleObject(stop, timeout) == WAIT_TIMEOUT)
+				WriteMetrics(metrics);
+			if(metrics[0] != 0)
+				WriteMetrics(metrics);
+
+			Log(OL_INFO, L"Server stopped\r\n");
+		}
+		else
+		{
+			result = 1;
+		}
+	}
+
+	CloseHandle(stop);
+	if(LogFile)
+		fclose(LogFile);
+	LogFile = NULL;
+	return result;
+}
+
+bool StopHeadless()
+{
+	HANDLE stop = OpenEvent(EVENT_MODIFY_STATE, FALSE, StopEventName);
+	if(!stop)
+		return false;
+	SetEvent(stop);
+	CloseHandle(stop);
+	return true;
+}
+
+bool LogHeadless(int level, const wchar_t * message)
+{
+	if(!Headless)
+		return false;
+	if(!LogFile || level > LogLevel)
+		return true;
+
+	const wchar_t * prefix = L"";
+	switch(level)
+	{
+	case OL_ERROR:		prefix = L"ERROR: "; break;
+	case OL_WARNING:	prefix = L"WARNING: "; break;
+	case OL_VERBOSE:	prefix = L"VERBOSE: "; break;
+	}
+
+	SYSTEMTIME t;
+	GetLocalTime(&t);
+	wchar_t line[1200];
+	_snwprintf_s(line, _TRUNCATE, L"%04i-%02i-%02i %02i:%02i:%02i.%03i %s%s", 
+		t.wYear, t.wMonth, t.wDay, t.wHour, t.wMinute, t.wSecond, t.wMilliseconds, prefix, message);
+
+	// Log files are UTF-8.
+	char utf8[4096];
+	int length = WideCharToMultiByte(CP_UTF8, 0, line, -1, utf8, sizeof(utf8), NULL, NULL);
+	if(length > 1)
+	{
+		fwrite(utf8, 1, length - 1, LogFile);
+		fflush(LogFile);
+	}
+	return true;
+}
\ No newline at end of file
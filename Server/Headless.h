@@ -0,0 +1,19 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "Windows.h"
+
+// Path of the config file next to the executable.
+void DefaultConfigPath(wchar_t (&path)[MAX_PATH]);
+
+// Run the server without any UI, configured by an ini file (next to the
+// executable if config is NULL). Returns when StopHeadless is called.
+int RunHeadless(const wchar_t * config);
+
+// Signal a running headless server to stop.
+bool StopHeadless();
+
+// Log a message if running headless. Returns false otherwise.
+bool LogHeadless(int level, const wchar_t * message);
+
+#endif
\ No newline at end of file
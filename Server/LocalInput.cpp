@@ -0,0 +1,159 @@
+#include "LocalInput.h"
+
+#include <cstring>
+
+// Copy bytes in and out of the ring, at a position that may wrap around.
+void CopyToRing(LocalInputRing * ring, DWORD at, const void * from, int size)
+{
+	DWORD offset = at & (LocalInputSize - 1);
+	int first = size < LocalInputSize - (int)offset ? size : LocalInputSize - (int)offset;
+	memcpy(ring->data + offset, from, first);
+	memcpy(ring->data, (const char *)from + first, size - first);
+}
+
+void CopyFromRing(const LocalInputRing * ring, DWORD at, void * to, int size)
+{
+	DWORD offset = at & (LocalInputSize - 1);
+	int first = size < LocalInputSize - (int)offset ? size : LocalInputSize - (int)offset;
+	memcpy(to, ring->data + offset, first);
+	memcpy((char *)to + first, ring->data, size - first);
+}
+
+// LocalInput
+LocalInput::LocalInput() : mapping(NULL), doorbell(NULL), ring(NULL)
+{
+}
+
+bool LocalInput::Open()
+{
+	Close();
+
+	mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(LocalInputRing), LocalInputName);
+	if(!mapping)
+		return false;
+	// Another server owns the ring.
+	if(GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		Close();
+		return false;
+	}
+
+	doorbell = CreateEvent(NULL, FALSE, FALSE, LocalInputEventName);
+	ring = (LocalInputRing *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LocalInputRing));
+	if(!doorbell || !ring)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void LocalInput::Close()
+{
+	if(ring)
+		UnmapViewOfFile(ring);
+	ring = NULL;
+	if(doorbell)
+		CloseHandle(doorbell);
+	doorbell = NULL;
+	if(mapping)
+		CloseHandle(mapping);
+	mapping = NULL;
+}
+
+int LocalInput::Read(char * buffer, int size)
+{
+	DWORD head = (DWORD)ring->head;
+	DWORD tail = (DWORD)ring->tail;
+	MemoryBarrier();
+	if(head == tail)
+		return 0;
+
+	unsigned short length = 0;
+	CopyFromRing(ring, head, &length, sizeof(length));
+	if(length > size || length > tail - head - sizeof(length))
+	{
+		// Not a record we can read, drop everything published.
+		InterlockedExchange(&ring->head, (LONG)tail);
+		return 0;
+	}
+	CopyFromRing(ring, head + sizeof(length), buffer, length);
+	InterlockedExchange(&ring->head, (LONG)(head + sizeof(length) + length));
+	return length;
+}
+
+// LocalInputClient
+LocalInputClient::LocalInputClient() : mapping(NULL), doorbell(NULL), lock(NULL), ring(NULL)
+{
+}
+
+bool LocalInputClient::Open()
+{
+	Close();
+
+	mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, LocalInputName);
+	doorbell = OpenEvent(EVENT_MODIFY_STATE, FALSE, LocalInputEventName);
+	lock = CreateMutex(NULL, FALSE, LocalInputLockName);
+	if(!mapping || !doorbell || !lock)
+	{
+		Close();
+		return false;
+	}
+
+	ring = (LocalInputRing *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LocalInputRing));
+	if(!ring)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void LocalInputClient::Close()
+{
+	if(ring)
+		UnmapViewOfFile(ring);
+	ring = NULL;
+	if(lock)
+		CloseHandle(lock);
+	lock = NULL;
+	if(doorbell)
+		CloseHandle(doorbell);
+	doorbell = NULL;
+	if(mapping)
+		CloseHandle(mapping);
+	mapping = NULL;
+}
+
+bool LocalInputClient::Send(const void * packet, int size, bool signal)
+{
+	if(size <= 0 || size > LocalInputRecord)
+		return false;
+
+	// A producer that died holding the lock left nothing half published.
+	DWORD wait = WaitForSingleObject(lock, INFINITE);
+	if(wait != WAIT_OBJECT_0 && wait != WAIT_ABANDONED)
+		return false;
+
+	unsigned short length = (unsigned short)size;
+	DWORD head = (DWORD)ring->head;
+	DWORD tail = (DWORD)ring->tail;
+	bool fits = LocalInputSize - (tail - head) >= sizeof(length) + size;
+	if(fits)
+	{
+		CopyToRing(ring, tail, &length, sizeof(length));
+		CopyToRing(ring, tail + sizeof(length), packet, size);
+		MemoryBarrier();
+		InterlockedExchange(&ring->tail, (LONG)(tail + sizeof(length) + size));
+	}
+	ReleaseMutex(lock);
+
+	if(fits && signal)
+		Signal();
+	return fits;
+}
+
+void LocalInputClient::Signal()
+{
+	SetEvent(doorbell);
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef LOCALINPUT_H
+#define LOCALINPUT_H
+
+#include "Windows.h"
+
+// Local tools submit packets to the server through a ring in shared memory, 
+// instead of connecting over TCP. Each record is a 16 bit length in host byte 
+// order, followed by a packet and its payload exactly as a client sends them.
+// Producers serialize on a mutex, the server thread is the only consumer, and 
+// producers set an event after publishing to wake it.
+const wchar_t * const LocalInputName = L"Local\\TouchpadServerInput";
+const wchar_t * const LocalInputLockName = L"Local\\TouchpadServerInputLock";
+const wchar_t * const LocalInputEventName = L"Local\\TouchpadServerInputEvent";
+
+// Size of the ring, a power of 2.
+const int LocalInputSize = 1 << 20;
+// Largest record the server accepts.
+const int LocalInputRecord = 4096;
+
+struct LocalInputRing
+{
+	volatile LONG head;		// Bytes consumed by the server.
+	volatile LONG tail;		// Bytes published by producers.
+	char data[LocalInputSize];
+};
+
+// The server's end of the ring.
+class LocalInput
+{
+protected:
+	HANDLE mapping;
+	HANDLE doorbell;
+	LocalInputRing * ring;
+
+private:
+	LocalInput(const LocalInput & copy);
+	void operator = (const LocalInput & assign);
+
+public:
+	LocalInput();
+	~LocalInput() { Close(); }
+
+	bool Open();
+	void Close();
+
+	bool IsOpen() { return ring != NULL; }
+	// Signaled when a producer has published records.
+	HANDLE Doorbell() { return doorbell; }
+
+	// Copy the next record into buffer. Returns its size, or 0 if the ring is empty.
+	int Read(char * buffer, int size);
+};
+
+// A local tool's end of the ring.
+class LocalInputClient
+{
+protected:
+	HANDLE mapping;
+	HANDLE doorbell;
+	HANDLE lock;
+	LocalInputRing * ring;
+
+private:
+	LocalInputClient(const LocalInputClient & copy);
+	void operator = (const LocalInputClient & assign);
+
+public:
+	LocalInputClient();
+	~LocalInputClient() { Close(); }
+
+	// Fails if the server isn't running.
+	bool Open();
+	void Close();
+
+	// Submit a packet and its payload, in network byte order. Returns false if 
+	// the ring is full. Set signal to false to submit a batch, and wake the 
+	// server after the last one.
+	bool Send(const void * packet, int size, bool signal = true);
+	void Signal();
+};
+
+#endif
\ No newline at end of file
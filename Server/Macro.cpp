@@ -0,0 +1,202 @@
+#include "Macro.h"
+#include "Server.h"
+
+#include <cwctype>
+
+// Input helpers.
+INPUT KeyDown(WORD vk);
+INPUT KeyUp(WORD vk);
+void AppendText(std::vector < INPUT > & input, const wchar_t * text, int length);
+
+static const wchar_t * BuiltIn[][2] =
+{
+	{ L"Show Desktop", L"win+d" },
+	{ L"Switch Window", L"alt+tab" },
+	{ L"Task Switcher", L"ctrl+alt+tab" },
+	{ L"Task Manager", L"ctrl+shift+esc" },
+	{ L"Close Window", L"alt+f4" },
+	{ L"Explorer", L"win+e" },
+	{ L"Run", L"win+r" },
+	{ L"Copy", L"ctrl+c" },
+	{ L"Cut", L"ctrl+x" },
+	{ L"Paste", L"ctrl+v" },
+	{ L"Undo", L"ctrl+z" },
+	{ L"Redo", L"ctrl+y" },
+	{ L"Select All", L"ctrl+a" },
+};
+
+struct KeyName
+{
+	const wchar_t * Name;
+	WORD Key;
+};
+
+static const KeyName KeyNames[] =
+{
+	{ L"ctrl", VK_CONTROL },
+	{ L"shift", VK_SHIFT },
+	{ L"alt", VK_MENU },
+	{ L"win", VK_LWIN },
+	{ L"enter", VK_RETURN },
+	{ L"esc", VK_ESCAPE },
+	{ L"tab", VK_TAB },
+	{ L"space", VK_SPACE },
+	{ L"backspace", VK_BACK },
+	{ L"delete", VK_DELETE },
+	{ L"insert", VK_INSERT },
+	{ L"home", VK_HOME },
+	{ L"end", VK_END },
+	{ L"pgup", VK_PRIOR },
+	{ L"pgdn", VK_NEXT },
+	{ L"up", VK_UP },
+	{ L"down", VK_DOWN },
+	{ L"left", VK_LEFT },
+	{ L"right", VK_RIGHT },
+	{ L"printscreen", VK_SNAPSHOT },
+	{ L"apps", VK_APPS },
+	{ L"volup", VK_VOLUME_UP },
+	{ L"voldown", VK_VOLUME_DOWN },
+	{ L"mute", VK_VOLUME_MUTE },
+	{ L"play", VK_MEDIA_PLAY_PAUSE },
+	{ L"next", VK_MEDIA_NEXT_TRACK },
+	{ L"prev", VK_MEDIA_PREV_TRACK },
+};
+
+// Map a key name to a virtual key, or 0 if it is unknown.
+static WORD KeyFromName(const std::wstring & name)
+{
+	if(name.size() == 1 && iswalnum(name[0]))
+		return (WORD)towupper(name[0]);
+	if(name.size() >= 2 && towlower(name[0]) == 'f' && iswdigit(name[1]))
+	{
+		int f = _wtoi(name.c_str() + 1);
+		if(f >= 1 && f <= 24)
+			return (WORD)(VK_F1 + f - 1);
+		return 0;
+	}
+	for(int i = 0; i < (int)(sizeof(KeyNames) / sizeof(KeyNames[0])); ++i)
+		if(_wcsicmp(name.c_str(), KeyNames[i].Name) == 0)
+			return KeyNames[i].Key;
+	return 0;
+}
+
+static std::wstring Trim(const std::wstring & s)
+{
+	std::size_t begin = s.find_first_not_of(L" \t");
+	if(begin == std::wstring::npos)
+		return std::wstring();
+	std::size_t end = s.find_last_not_of(L" \t");
+	return s.substr(begin, end - begin + 1);
+}
+
+// Find the next comma that isn't quoted.
+static std::size_t FindComma(const std::wstring & s, std::size_t at)
+{
+	bool quoted = false;
+	for(; at < s.size(); ++at)
+	{
+		if(s[at] == '"')
+			quoted = !quoted;
+		else if(s[at] == ',' && !quoted)
+			return at;
+	}
+	return s.size();
+}
+
+// Parse a delay, digits followed by "ms". Returns false if item isn't one, 
+// so single digit keys are still chords.
+static bool ParseDelay(const std::wstring & item, int & delay)
+{
+	std::size_t unit = item.find_first_not_of(L"0123456789");
+	if(unit == 0 || unit == std::wstring::npos || _wcsicmp(Trim(item.substr(unit)).c_str(), L"ms") != 0)
+		return false;
+	delay = _wtoi(item.c_str());
+	return true;
+}
+
+static bool Compile(const std::wstring & spec, Macro & macro)
+{
+	macro.Steps.assign(1, MacroStep());
+	for(std::size_t at = 0; at < spec.size(); )
+	{
+		std::size_t comma = FindComma(spec, at);
+		std::wstring item = Trim(spec.substr(at, comma - at));
+		at = comma + 1;
+		if(item.empty())
+			continue;
+
+		MacroStep & step = macro.Steps.back();
+		if(item[0] == '"')
+		{
+			// Text.
+			if(item.size() < 2 || item[item.size() - 1] != '"')
+				return false;
+			AppendText(step.Input, item.c_str() + 1, (int)item.size() - 2);
+		}
+		else if(ParseDelay(item, step.Delay))
+		{
+			// Delay, the following items are the next batch.
+			macro.Steps.push_back(MacroStep());
+		}
+		else
+		{
+			// Chord, pressed in order and released in reverse.
+			std::vector < WORD > keys;
+			for(std::size_t k = 0; k <= item.size(); )
+			{
+				std::size_t plus = item.find('+', k);
+				if(plus == std::wstring::npos)
+					plus = item.size();
+				WORD key = KeyFromName(Trim(item.substr(k, plus - k)));
+				if(key == 0)
+					return false;
+				keys.push_back(key);
+				k = plus + 1;
+			}
+			for(std::size_t k = 0; k < keys.size(); ++k)
+				step.Input.push_back(KeyDown(keys[k]));
+			for(std::size_t k = keys.size(); k > 0; --k)
+				step.Input.push_back(KeyUp(keys[k - 1]));
+		}
+	}
+
+	// A trailing delay leaves an empty batch.
+	if(macro.Steps.size() > 1 && macro.Steps.back().Input.empty())
+		macro.Steps.pop_back();
+	return true;
+}
+
+MacroTable::MacroTable()
+{
+	for(int i = 0; i < (int)(sizeof(BuiltIn) / sizeof(BuiltIn[0])); ++i)
+		Add(BuiltIn[i][0], BuiltIn[i][1]);
+}
+
+bool MacroTable::Add(const wchar_t * name, const wchar_t * spec)
+{
+	Macro macro;
+	macro.Name = name;
+	if(!Compile(spec, macro))
+		return false;
+	macros.push_back(macro);
+	return true;
+}
+
+void MacroTable::Load(const wchar_t * path)
+{
+	std::vector < wchar_t > section(32767);
+	DWORD length = GetPrivateProfileSection(L"Macros", &section[0], section.size(), path);
+
+	// Entries are Name=spec, each null terminated.
+	for(const wchar_t * entry = &section[0]; entry < &section[0] + length && *entry; entry += wcslen(entry) + 1)
+	{
+		std::wstring line(entry);
+		std::size_t equals = line.find('=');
+		if(equals == std::wstring::npos)
+			continue;
+
+		std::wstring name = Trim(line.substr(0, equals));
+		if(!Add(name.c_str(), line.c_str() + equals + 1))
+			Log(OL_WARNING, L"Invalid macro %s\r\n", name.c_str());
+	}
+}
\ No newline at end of file
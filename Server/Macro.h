@@ -0,0 +1,45 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include "Windows.h"
+
+#include <string>
+#include <vector>
+
+// One batch of input, injected with a single SendInput, followed by a delay.
+struct MacroStep
+{
+	std::vector < INPUT > Input;
+	int Delay;	// ms
+
+	MacroStep() : Delay(0) { }
+};
+
+struct Macro
+{
+	std::wstring Name;
+	std::vector < MacroStep > Steps;
+};
+
+// Named macros, compiled to input when they are loaded. A macro is written
+// as a comma separated list of key chords ("ctrl+shift+esc"), quoted text, 
+// and delays ("200ms"). Chords and text between delays are one batch.
+class MacroTable
+{
+protected:
+	std::vector < Macro > macros;
+
+public:
+	// Starts with the built in macros.
+	MacroTable();
+
+	// Add a macro. Returns false if the spec is malformed.
+	bool Add(const wchar_t * name, const wchar_t * spec);
+	// Add the macros in the [Macros] section of an ini file, as Name=spec.
+	void Load(const wchar_t * path);
+
+	std::size_t Count() const { return macros.size(); }
+	const Macro & operator [] (std::size_t i) const { return macros[i]; }
+};
+
+#endif
\ No newline at end of file
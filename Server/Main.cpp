@@ -1,4 +1,5 @@
 #include "Server.h"
+#include "Headless.h"
 
 #include "resource.h"
 
@@ -14,6 +15,9 @@ NOTIFYICONDATA Notify;
 int Port = DefaultPort;
 // Password hash.
 int Password = 0;
+// Low latency mode, and the core to pin the server to (or -1).
+int LowLatency = 0;
+int LowLatencyCore = -1;
 
 // Server thread.
 Server server;
@@ -22,9 +26,6 @@ Server server;
 HWND LogWnd = NULL;
 HWND StatusWnd = NULL;
 
-// Compute hash of string.
-int Hash(const wchar_t * str);
-
 // Load preferences from globals.
 void LoadPreferences(HWND hWnd)
 {
@@ -41,6 +42,14 @@ void LoadPreferences(HWND hWnd)
 		dwSize = sizeof(DWORD);
 		RegQueryValueEx(key, L"Password", NULL, &dwType, (BYTE *)&Password, &dwSize);
 
+		dwType = REG_DWORD;
+		dwSize = sizeof(DWORD);
+		RegQueryValueEx(key, L"LowLatency", NULL, &dwType, (BYTE *)&LowLatency, &dwSize);
+
+		dwType = REG_DWORD;
+		dwSize = sizeof(DWORD);
+		RegQueryValueEx(key, L"LowLatencyCore", NULL, &dwType, (BYTE *)&LowLatencyCore, &dwSize);
+
 		RegCloseKey(key);
 	}
 
@@ -87,14 +96,8 @@ bool SavePreferences(HWND hWnd)
 		return false;
 	}
 
-	// Validation passed, set options.
-	bool init = !server.IsRunning();
-	if(port != Port)
-		init = true;
-	if(password != Password)
-		init = true;
-
-	if(init && !server.Run(port, password))
+	// Validation passed, apply options without dropping the client.
+	if(!server.Reconfigure(port, password))
 	{
 		MessageBox(hWnd, L"Error starting server!", L"Error", MB_OK | MB_ICONERROR);
 		return false;
@@ -226,6 +229,13 @@ BOOL CALLBACK DialogProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 			0));
 
 		LoadPreferences(hWnd);
+		server.SetLowLatency(LowLatency != 0, LowLatencyCore);
+		{
+			// User macros are in the config file shared with headless mode.
+			wchar_t config[MAX_PATH];
+			DefaultConfigPath(config);
+			server.LoadMacros(config);
+		}
 		server.Run(Port, Password);
 		return TRUE;
 
@@ -256,6 +266,7 @@ BOOL CALLBACK DialogProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 			DestroyWindow(hWnd);
 			return TRUE;
 		case ID_CONTEXT_RESTARTSERVER:
+			// Restart from scratch, dropping the client.
 			LoadPreferences(hWnd);
 			server.Run(Port, Password);
 			return TRUE;
@@ -283,6 +294,24 @@ int CALLBACK WinMain(HINSTANCE, HINSTANCE, LPSTR lpCmdLine, int)
 {	
 	InitSockets();
 
+	// Command line options.
+	int argc = 0;
+	wchar_t ** argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+	if(argv && argc >= 2 && _wcsicmp(argv[1], L"/headless") == 0)
+	{
+		int result = RunHeadless(argc >= 3 ? argv[2] : NULL);
+		LocalFree(argv);
+		CloseSockets();
+		return result;
+	}
+	if(argv && argc >= 2 && _wcsicmp(argv[1], L"/stop") == 0)
+	{
+		LocalFree(argv);
+		CloseSockets();
+		return StopHeadless() ? 0 : 1;
+	}
+	LocalFree(argv);
+
 	HWND hWnd = CreateDialog(NULL, MAKEINTRESOURCE(IDD_DIALOG), NULL, DialogProc);
 	
 	MSG msg;
@@ -315,6 +344,10 @@ void Log(int level, const wchar_t * s, ...)
 	nSize = _vsnwprintf_s(buffer, sizeof(buffer) / sizeof(buffer[0]) - 1, s, args);
 	va_end(args);
 
+	// Headless servers log to a file instead.
+	if(LogHeadless(level, buffer))
+		return;
+
 	// Status goes to tooltip and status window.
 	if(status)
 	{
@@ -364,14 +397,3 @@ void Log(int level, const wchar_t * s, ...)
 
 	delete [] text;
 }
-
-// http://www.cse.yorku.ca/~oz/hash.html
-int Hash(const wchar_t * str)
-{
-	int hash = 5381;
-	int c;
-	while(c = *str++)
-		hash = hash * 33 + c;
-
-	return hash;
-}
@@ -0,0 +1,79 @@
+#include "Metrics.h"
+#include "Windows.h"
+
+#include <cstdio>
+
+static volatile long Metrics[M_COUNT] = { 0 };
+
+void Count(METRIC m, long n)
+{
+	InterlockedExchangeAdd(&Metrics[m], n);
+}
+
+void Gauge(METRIC m, long value)
+{
+	InterlockedExchange(&Metrics[m], value);
+}
+
+void Peak(METRIC m, long value)
+{
+	long current = Metrics[m];
+	while(current < value)
+	{
+		long previous = InterlockedCompareExchange(&Metrics[m], value, current);
+		if(previous == current)
+			break;
+		current = previous;
+	}
+}
+
+long Metric(METRIC m)
+{
+	return Metrics[m];
+}
+
+const wchar_t * MetricName(METRIC m)
+{
+	switch(m)
+	{
+	case M_PACKETS: return L"packets";
+	case M_INPUTS: return L"inputs";
+	case M_SENDINPUTS: return L"sendinputs";
+	case M_CLIENTS: return L"clients";
+	case M_REJECTED: return L"rejected";
+	case M_BEACONS: return L"beacons";
+	case M_STARTUP_US: return L"startup_us";
+	case M_CLOCK_SYNCS: return L"clock_syncs";
+	case M_RTT_US: return L"rtt_us";
+	case M_CLOCK_OFFSET_MS: return L"clock_offset_ms";
+	case M_TOUCH_LATENCY_US: return L"touch_latency_us";
+	case M_CREDITS: return L"credits";
+	case M_BUTTON_LATENCY_US: return L"button_latency_us";
+	case M_MOTION_LATENCY_US: return L"motion_latency_us";
+	case M_HANDSHAKE_LATENCY_US: return L"handshake_latency_us";
+	case M_DISCOVERY_LATENCY_US: return L"discovery_latency_us";
+	case M_INPUT_LATENCY_MAX_US: return L"input_latency_max_us";
+	case M_INPUT_LATE: return L"input_late";
+	case M_LOCAL_PACKETS: return L"local_packets";
+	case M_BULK_LATENCY_US: return L"bulk_latency_us";
+	case M_CLIPBOARD_BYTES: return L"clipboard_bytes";
+	case M_CLIPBOARDS: return L"clipboards";
+	case M_RESTARTS: return L"restarts";
+	case M_RECOVERY_US: return L"recovery_us";
+	case M_STALLS: return L"stalls";
+	default: return L"unknown";
+	}
+}
+
+bool WriteMetrics(const wchar_t * path)
+{
+	FILE * file = NULL;
+	if(_wfopen_s(&file, path, L"w") != 0)
+		return false;
+
+	for(int i = 0; i < M_COUNT; ++i)
+		fwprintf(file, L"%s %li\n", MetricName((METRIC)i), Metric((METRIC)i));
+
+	fclose(file);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Server metrics.
+enum METRIC
+{
+	M_PACKETS,
+	M_INPUTS,
+	M_SENDINPUTS,
+	M_CLIENTS,
+	M_REJECTED,
+	M_BEACONS,
+	M_STARTUP_US,
+	M_CLOCK_SYNCS,
+	M_RTT_US,
+	M_CLOCK_OFFSET_MS,
+	M_TOUCH_LATENCY_US,
+	M_CREDITS,
+	M_BUTTON_LATENCY_US,
+	M_MOTION_LATENCY_US,
+	M_HANDSHAKE_LATENCY_US,
+	M_DISCOVERY_LATENCY_US,
+	M_INPUT_LATENCY_MAX_US,
+	M_INPUT_LATE,
+	M_LOCAL_PACKETS,
+	M_BULK_LATENCY_US,
+	M_CLIPBOARD_BYTES,
+	M_CLIPBOARDS,
+	M_RESTARTS,
+	M_RECOVERY_US,
+	M_STALLS,
+
+	M_COUNT,
+};
+
+// Add to a counter.
+void Count(METRIC m, long n = 1);
+// Set a gauge.
+void Gauge(METRIC m, long value);
+// Raise a gauge to value if it is lower.
+void Peak(METRIC m, long value);
+
+long Metric(METRIC m);
+const wchar_t * MetricName(METRIC m);
+
+// Write a snapshot of the metrics to a file, one "name value" per line.
+bool WriteMetrics(const wchar_t * path);
+
+#endif
\ No newline at end of file
@@ -13,6 +13,10 @@ enum CONTROL
 	C_ACK				= 0x03,
 	C_SUSPEND			= 0x04,
 	C_RESUME			= 0x05,
+	C_CLOCK				= 0x06,
+	C_CREDIT			= 0x07,
+	C_MACROS			= 0x08,
+	C_HELLO				= 0x09,
 
 	// Mouse packets.
 	C_MOUSE_MOVE		= 0x11,
@@ -20,17 +24,144 @@ enum CONTROL
 	C_MOUSE_BUTTONUP	= 0x13,
 	C_MOUSE_SCROLL		= 0x16,
 	C_MOUSE_SCROLL2		= 0x17,
+	C_TOUCH				= 0x18,
+	C_MOUSE_MOVES		= 0x19,
 
 	// Keyboard packets.
 	C_CHAR				= 0x20,
 	C_KEYPRESS			= 0x21,
 	C_KEYDOWN			= 0x22,
 	C_KEYUP				= 0x23,
+	C_TEXT				= 0x24,
+	C_MACRO				= 0x25,
+	C_KEY				= 0x26,
+	C_COMPOSE			= 0x27,
+
+	// Gamepad packets.
+	C_GAMEPAD			= 0x30,
+
+	// Clipboard packets.
+	C_CLIPBOARD			= 0x40,
 	
 	// Empty packet.
 	C_NULL				= 0xFF,
 };
 
+// Port servers listen on and answer beacon pings on, unless configured otherwise.
+const int DefaultPort = 2999;
+
+// Hash of a password, sent in the Password of C_CONNECT.
+// http://www.cse.yorku.ca/~oz/hash.html
+inline int Hash(const wchar_t * str)
+{
+	int hash = 5381;
+	int c;
+	while(c = *str++)
+		hash = hash * 33 + c;
+
+	return hash;
+}
+
+// Number of packets a client may send before the server returns credits for
+// them with C_CREDIT. Sent in the window of the C_HELLO reply.
+const int CreditWindow = 64;
+
+// Capabilities exchanged by C_HELLO, which a client sends as its first packet
+// after the handshake. The client asks for the replies it reads, and the 
+// server answers with everything it supports. Clients that don't send 
+// C_HELLO get no replies, and servers that don't answer it get none of the 
+// newer packets.
+enum CAPABILITY
+{
+	// Replies the client reads.
+	CAP_CREDITS			= 0x0001,	// Flow control with C_CREDIT.
+	CAP_MACROS			= 0x0002,	// C_MACROS list.
+
+	// Packets the server accepts.
+	CAP_MOTION			= 0x0100,	// C_MOUSE_MOVES.
+	CAP_COMPOSE			= 0x0200,	// C_COMPOSE.
+	CAP_CLIPBOARD		= 0x0400,	// C_CLIPBOARD.
+	CAP_TEXT			= 0x0800,	// C_TEXT and C_KEY.
+	CAP_TOUCH			= 0x1000,	// C_TOUCH.
+	CAP_GAMEPAD			= 0x2000,	// C_GAMEPAD.
+	CAP_CLOCK			= 0x4000,	// C_CLOCK.
+};
+
+// Maximum number of UTF-16 code units in a C_TEXT or C_COMPOSE packet, and
+// characters deleted by a C_COMPOSE packet.
+const int MaxTextLength = 1024;
+
+// Maximum number of MotionSamples in a C_MOUSE_MOVES packet, and the units 
+// of their deltas per pixel.
+const int MaxMotionSamples = 64;
+const int MotionScale = 16;
+
+// Largest chunk of a clipboard transfer, and the largest transfer.
+const int MaxClipboardChunk = 4096;
+const int MaxClipboardSize = 16 << 20;
+
+// Reason sent with C_DISCONNECT when the server closes a connection.
+enum DISCONNECT_REASON
+{
+	DR_HANDSHAKE		= 0x00,		// The handshake was malformed.
+	DR_PASSWORD			= 0x01,		// Bad password.
+	DR_REPLACED			= 0x02,		// Another client connected.
+};
+
+// Clipboard formats.
+enum CLIPBOARD_FORMAT
+{
+	CLIP_TEXT			= 0x00,		// UTF-8 text.
+	CLIP_PNG			= 0x01,		// PNG image.
+};
+
+// Clipboard chunk flags.
+enum CLIPBOARD_FLAG
+{
+	CLIP_BEGIN			= 0x01,		// First chunk of a transfer.
+	CLIP_END			= 0x02,		// Last chunk, the transfer is complete.
+};
+
+// Raw touch actions.
+enum TOUCH_ACTION
+{
+	TA_DOWN				= 0x00,
+	TA_MOVE				= 0x01,
+	TA_UP				= 0x02,
+
+	// Pointer went down in the scroll bar.
+	TA_EDGE				= 0x80,
+};
+
+// Modifiers held around a C_KEY press.
+enum KEY_MODIFIER
+{
+	KM_SHIFT			= 0x01,
+	KM_CTRL				= 0x02,
+	KM_ALT				= 0x04,
+	KM_WIN				= 0x08,
+};
+
+// Gamepad buttons, the same bits as XInput.
+enum GAMEPAD_BUTTON
+{
+	GB_DPAD_UP			= 0x0001,
+	GB_DPAD_DOWN		= 0x0002,
+	GB_DPAD_LEFT		= 0x0004,
+	GB_DPAD_RIGHT		= 0x0008,
+	GB_START			= 0x0010,
+	GB_BACK				= 0x0020,
+	GB_LEFT_THUMB		= 0x0040,
+	GB_RIGHT_THUMB		= 0x0080,
+	GB_LEFT_SHOULDER	= 0x0100,
+	GB_RIGHT_SHOULDER	= 0x0200,
+	GB_GUIDE			= 0x0400,
+	GB_A				= 0x1000,
+	GB_B				= 0x2000,
+	GB_X				= 0x4000,
+	GB_Y				= 0x8000,
+};
+
 #pragma pack(push, 1)
 struct Packet
 {
@@ -49,11 +180,47 @@ struct Packet
 			short keycode;	// ANDROID_KEYCODE
 			short meta;
 		} Key;
+		struct
+		{
+			short keycode;				// ANDROID_KEYCODE
+			unsigned char modifiers;	// KEY_MODIFIER
+			unsigned char repeat;		// Number of presses.
+		} KeyEvent;
+		struct
+		{
+			unsigned short deleted;	// Characters to delete before the cursor.
+			unsigned short length;	// UTF-16 code units to insert following the packet.
+		} Compose;
+		struct
+		{
+			unsigned short length;	// Bytes of clipboard data following the packet.
+			unsigned char format;	// CLIPBOARD_FORMAT
+			unsigned char flags;	// CLIPBOARD_FLAG
+		} Clip;
+		struct
+		{
+			unsigned char count;	// Number of MotionSamples following the packet.
+		} Motion;
+		struct
+		{
+			unsigned short capabilities;	// CAPABILITY
+			unsigned short window;			// Credits granted by the server, or 0.
+		} Hello;
+		struct
+		{
+			unsigned char count;	// Number of TouchPoints following the packet.
+			unsigned char mode;		// Multitouch mode.
+			unsigned short scale;	// Sensitivity, 8.8 fixed point.
+		} Touch;
 		char Button;
 		char Reason;
 		int Count;
 
 		unsigned short Port;
+		// Length of the payload following the packet.
+		unsigned short Length;
+		// Index of a macro, in the order of the C_MACROS list.
+		unsigned short Macro;
 
 		unsigned int _padding;
 	};
@@ -62,4 +229,61 @@ struct Packet
 
 static_assert(sizeof(Packet) == 5, "sizeof(Packet) != 5");
 
+// Raw touch sample following a C_TOUCH packet. Coordinates are scaled so
+// the touch slop is 16 units.
+#pragma pack(push, 1)
+struct TouchPoint
+{
+	unsigned char Pointer;
+	unsigned char Action;	// TOUCH_ACTION
+	short x, y;
+	unsigned short Time;	// Event time in ms.
+};
+#pragma pack(pop)
+
+static_assert(sizeof(TouchPoint) == 8, "sizeof(TouchPoint) != 8");
+
+// Relative motion sample following a C_MOUSE_MOVES packet, one for each 
+// sample the touchscreen reported. Deltas are in 1/MotionScale pixels.
+#pragma pack(push, 1)
+struct MotionSample
+{
+	short dx, dy;
+	unsigned short Time;	// Event time in ms.
+};
+#pragma pack(pop)
+
+static_assert(sizeof(MotionSample) == 6, "sizeof(MotionSample) != 6");
+
+// Clock synchronization payload following a C_CLOCK packet. Times are in
+// microseconds. The client sends Origin along with its current estimates, 
+// and the server fills in Receive and Transmit and sends it back.
+#pragma pack(push, 1)
+struct ClockSync
+{
+	__int64 Origin;		// Client time the request was sent.
+	__int64 Receive;	// Server time the request arrived.
+	__int64 Transmit;	// Server time the reply was sent.
+	__int64 Offset;		// Server time - client time.
+	int Rtt;			// Round trip time, or -1 if unknown.
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ClockSync) == 36, "sizeof(ClockSync) != 36");
+
+// Full gamepad state following a C_GAMEPAD packet. Clients send these at a 
+// fixed rate, and the server applies only the newest one.
+#pragma pack(push, 1)
+struct GamepadState
+{
+	unsigned short Sequence;
+	unsigned short Buttons;				// GAMEPAD_BUTTON
+	short LeftX, LeftY;					// Up and right are positive.
+	short RightX, RightY;
+	unsigned char LeftTrigger, RightTrigger;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(GamepadState) == 14, "sizeof(GamepadState) != 14");
+
 #endif
\ No newline at end of file
@@ -1,45 +1,145 @@
 #include "Server.h"
+#include "Metrics.h"
 
 #include <vector>
+#include <algorithm>
 
 using namespace ts;
 
 // Map android keycode to VK.
 UINT MapKeycode(ANDROID_KEYCODE keycode);
 
+// Number of inputs locked in memory in low latency mode.
+const int InputBatch = 1024;
+
+// Work each traffic class may do per pass of the server loop: packets for 
+// client traffic, handshakes, and replies to beacon pings. Clipboard chunks 
+// are limited so a large paste doesn't hold up the input behind it.
+const int Budget[TC_COUNT] = { 64, 256, 16, 1, 8 };
+
+// Local packets handled per pass.
+const int LocalBudget = 1024;
+
+// Input should be injected within this many microseconds of arriving.
+const int InputTarget = 2000;
+
+// Longest a pass waits in total for the rest of client packets, in ms. Well 
+// under the supervisor's stall timeout, so a slow client isn't a stall.
+const int PayloadTimeout = 1000;
+
+// How long an injected stall blocks the server thread, in ms.
+const int FaultStall = 3000;
+
+// Capabilities the server answers C_HELLO with.
+const int ServerCapabilities = 
+	CAP_CREDITS | CAP_MACROS | 
+	CAP_MOTION | CAP_COMPOSE | CAP_CLIPBOARD | CAP_TEXT | CAP_TOUCH | CAP_GAMEPAD | CAP_CLOCK;
+
+// Longest macro list sent, in characters. It follows the C_HELLO reply into 
+// a socket with nothing else queued, and this keeps both well under the 8 KB
+// send buffer Windows gives a socket by default.
+const int MaxMacroList = 2048;
+
+// Macros waiting behind the one running, more triggers are dropped.
+const int MaxMacroQueue = 16;
+
+// Service latency gauge for each traffic class.
+const METRIC Latency[TC_COUNT] = { M_BUTTON_LATENCY_US, M_MOTION_LATENCY_US, M_BULK_LATENCY_US, M_HANDSHAKE_LATENCY_US, M_DISCOVERY_LATENCY_US };
+
+// Traffic class of a client packet.
+TRAFFIC_CLASS Classify(const Packet & p)
+{
+	switch(p.Control)
+	{
+	case C_MOUSE_BUTTONDOWN:
+	case C_MOUSE_BUTTONUP:
+	case C_CHAR:
+	case C_KEYPRESS:
+	case C_KEYDOWN:
+	case C_KEYUP:
+	case C_TEXT:
+	case C_KEY:
+	case C_COMPOSE:
+		return TC_BUTTON;
+	case C_CLIPBOARD:
+		return TC_BULK;
+	default:
+		return TC_MOTION;
+	}
+}
+
+Server::Server() : port(0), password(0), pendingPort(0), reconfigured(false), listening(false), lowLatency(false), lowLatencyCore(-1), lowLatencyEnabled(false), lowLatencyTask(NULL), inputLockedAt(NULL), inputLocked(0), workingSetMinimum(0), workingSetMaximum(0), clockOffset(0), rtt(-1), gamepadPending(false), gamepadTimeout(0), 
+	macro(-1), macroStep(0), macroDue(0), handshakeReceived(0), handshakeStart(0), 
+	clipboard(new WindowsClipboard()), clipboardFormat(0), clipboardReceiving(false), localPayload(NULL), localRemaining(0), 
+	heartbeat(0), fault(SF_NONE), clientPartial(false), clientCapabilities(0), motionX(0), motionY(0), localMotionX(0), localMotionY(0), 
+	network(CreateEvent(NULL, TRUE, FALSE, NULL)), woke(0), streamAt(0), streamEnd(0), payloadDeadline(0)
+{
+	for(int i = 0; i < TC_COUNT; ++i)
+		idle[i] = 0;
+}
+
+Server::~Server()
+{
+	supervisor.Stop();
+	Thread::Stop();
+	delete clipboard;
+	CloseHandle(network);
+}
+
 bool Server::IsRunning()
 {
-	return server.IsValid() && Thread::IsRunning();
+	Lock lock(reconfigure);
+	return listening;
 }
 
 bool Server::Run(short port, int password)
 {
+	supervisor.Stop();
 	Thread::Stop();	
 
 	// Close sockets.
+	{
+		Lock lock(reconfigure);
+		listening = false;
+		pending.Close();
+		pendingBeacon.Close();
+		reconfigured = false;
+	}
 	client.Close();
 	server.Close();
 	for(int i = 0; i < 2; ++i)
 		beacons[i].Close();
+	handshake.Close();
+	clientPartial = false;
+	fault = SF_NONE;
 	
 	try
 	{
 		// Listen for clients.
 		server.Listen(port, 3, false);
+		server.Watch(network, FD_ACCEPT);
 		
 		// Bind beacons.
-		try { beacons[0].Bind(DefaultPort, false); } 
+		try { beacons[0].Bind(DefaultPort, false); beacons[0].Watch(network, FD_READ); } 
 		catch(socket_exception & ex) { Log(OL_ERROR, L"%S", ex.what()); }
 		if(port != DefaultPort)
 		{
-			try { beacons[1].Bind(port, false); } 
+			try { beacons[1].Bind(port, false); beacons[1].Watch(network, FD_READ); } 
 			catch(socket_exception & ex) { Log(OL_ERROR, L"%S", ex.what()); }
 		}
 
 		this->port = port;
 		this->password = password;
 
+		if(!local.IsOpen() && !local.Open())
+			Log(OL_WARNING, L"Local input is unavailable\r\n");
+
 		Thread::Run();
+		supervisor.Start(this);
+		{
+			Lock lock(reconfigure);
+			listening = true;
+		}
 
 		std::wstring host = Address::LocalHost(port).ToString();
 		Log(OL_NOTIFY | OL_STATUS | OL_INFO, L"Server running at %s\r\n", host.c_str());
@@ -56,6 +156,136 @@ bool Server::Run(short port, int password)
 	}
 }
 
+bool Server::Reconfigure(short port, int password)
+{
+	if(!IsRunning())
+		return Run(port, password);
+
+	// The new password applies to the next handshake.
+	if(password != this->password)
+	{
+		InterlockedExchange(&this->password, password);
+		Log(OL_INFO, L"Password changed\r\n");
+	}
+
+	bool cancelled = false;
+	{
+		Lock lock(reconfigure);
+		// Changing back to the live port before the server thread applied the
+		// change cancels it, the live listener already holds that port.
+		if(port == this->port)
+		{
+			if(!reconfigured)
+				return true;
+			pending.Close();
+			pendingBeacon.Close();
+			reconfigured = false;
+			cancelled = true;
+		}
+		else if(reconfigured && port == pendingPort)
+		{
+			return true;
+		}
+	}
+	if(cancelled)
+	{
+		std::wstring host = Address::LocalHost(port).ToString();
+		Log(OL_NOTIFY | OL_STATUS | OL_INFO, L"Server running at %s\r\n", host.c_str());
+		return true;
+	}
+
+	// Open the new listener alongside the old one, the server thread swaps them.
+	TcpSocket listener;
+	UdpSocket beacon;
+	try
+	{
+		listener.Listen(port, 3, false);
+		listener.Watch(network, FD_ACCEPT);
+		if(port != DefaultPort)
+		{
+			try { beacon.Bind(port, false); beacon.Watch(network, FD_READ); } 
+			catch(socket_exception & ex) { Log(OL_ERROR, L"%S", ex.what()); }
+		}
+	}
+	catch(socket_exception & ex)
+	{
+		Log(OL_ERROR, L"%S", ex.what());
+		Log(OL_NOTIFY | OL_STATUS | OL_ERROR, L"Error initializing server on port %i!\r\n", port);
+		return false;
+	}
+
+	{
+		Lock lock(reconfigure);
+		pending.Close();
+		pending.Take(listener);
+		pendingBeacon.Close();
+		pendingBeacon.Take(beacon);
+		pendingPort = port;
+		reconfigured = true;
+	}
+
+	std::wstring host = Address::LocalHost(port).ToString();
+	Log(OL_NOTIFY | OL_STATUS | OL_INFO, L"Server running at %s\r\n", host.c_str());
+	return true;
+}
+
+void Server::SetLowLatency(bool enable, int core)
+{
+	lowLatency = enable;
+	lowLatencyCore = core;
+}
+
+void Server::EnableLowLatency()
+{
+	if(ts::SetLowLatency(lowLatencyCore, &lowLatencyTask))
+		Log(OL_INFO, L"Low latency mode enabled\r\n");
+	else
+		Log(OL_WARNING, L"Failed to enable low latency mode\r\n");
+	lowLatencyEnabled = true;
+
+	// Keep the server state and the input batch from page faulting. clear 
+	// keeps the capacity, so the batch stays in the locked pages until a pass 
+	// injects more than InputBatch, and InjectInput locks the new pages.
+	// Locking may grow the working set, so its size is kept to restore.
+	GetProcessWorkingSetSize(GetCurrentProcess(), &workingSetMinimum, &workingSetMaximum);
+	input.reserve(InputBatch);
+	inputLocked = input.capacity();
+	input.resize(inputLocked);
+	inputLockedAt = &input[0];
+	if(!LockMemory(this, sizeof(*this)) || !LockMemory(inputLockedAt, inputLocked * sizeof(INPUT)))
+		Log(OL_WARNING, L"Failed to lock server memory\r\n");
+	input.clear();
+}
+
+void Server::DisableLowLatency()
+{
+	if(!lowLatencyEnabled)
+		return;
+	ts::ClearLowLatency(lowLatencyTask);
+	lowLatencyTask = NULL;
+	lowLatencyEnabled = false;
+
+	UnlockMemory(this, sizeof(*this));
+	UnlockMemory(inputLockedAt, inputLocked * sizeof(INPUT));
+	inputLockedAt = NULL;
+	inputLocked = 0;
+	if(workingSetMinimum > 0)
+		SetProcessWorkingSetSize(GetCurrentProcess(), workingSetMinimum, workingSetMaximum);
+}
+
+void Server::ApplyConfiguration()
+{
+	Lock lock(reconfigure);
+
+	// The connected client is untouched, only the listener and beacon change.
+	server.Close();
+	server.Take(pending);
+	beacons[1].Close();
+	beacons[1].Take(pendingBeacon);
+	port = pendingPort;
+	reconfigured = false;
+}
+
 // Mouse input helpers.
 INPUT MouseMove(int dx, int dy)
 {
@@ -141,175 +371,985 @@ INPUT CharUp(WORD ch)
 	return in;
 }
 
-void Server::HandlePackets()
+// Append recognized gestures to an input batch.
+void AppendGestures(std::vector < INPUT > & input, const std::vector < Gesture > & gestures)
 {
-	Packet p;
-	if(client.Receive(&p, sizeof(p), 10) == sizeof(p))
-	{		
-		std::vector < INPUT > input;
-		switch(p.Control)
-		{
-		case C_MOUSE_MOVE:		
-			Log(OL_VERBOSE, L"MOUSE_MOVE %i %i\r\n", (int)p.Delta2D.dx, (int)p.Delta2D.dy);
-			input.push_back(MouseMove(p.Delta2D.dx, p.Delta2D.dy));
-			break;
-		case C_MOUSE_BUTTONDOWN:
-			Log(OL_VERBOSE, L"MOUSE_BUTTONDOWN %i\r\n", (int)p.Button);
-			input.push_back(MouseButtonDown(p.Button));
-			break;
-		case C_MOUSE_BUTTONUP:
-			Log(OL_VERBOSE, L"MOUSE_BUTTONUP %i\r\n", (int)p.Button);
-			input.push_back(MouseButtonUp(p.Button));
-			break;
-		case C_MOUSE_SCROLL:
-			Log(OL_VERBOSE, L"MOUSE_SCROLL %i\r\n", (int)p.Delta);
-			input.push_back(MouseWheel(p.Delta));
-			break;
-		case C_MOUSE_SCROLL2:
-			Log(OL_VERBOSE, L"MOUSE_SCROLL2 %i %i\r\n", (int)p.Delta2D.dx, (int)p.Delta2D.dy);
-			if(p.Delta2D.dx != 0)
-				input.push_back(MouseHWheel(p.Delta2D.dx));
-			if(p.Delta2D.dy != 0)
-				input.push_back(MouseWheel(p.Delta2D.dy));
+	for(std::size_t i = 0; i < gestures.size(); ++i)
+	{
+		const Gesture & g = gestures[i];
+		switch(g.Event)
+		{
+		case GE_MOVE: 
+			input.push_back(MouseMove(g.dx, g.dy)); 
 			break;
-		
-		case C_CHAR:
-			Log(OL_VERBOSE, L"CHAR %c\r\n", ntohs(p.Char));
-			input.push_back(CharDown(ntohs(p.Char)));
-			input.push_back(CharUp(ntohs(p.Char)));
+		case GE_SCROLL:
+			if(g.dx != 0)
+				input.push_back(MouseHWheel(g.dx));
+			if(g.dy != 0)
+				input.push_back(MouseWheel(g.dy));
 			break;
-		case C_KEYPRESS:	
-			Log(OL_VERBOSE, L"KEYPRESS %i 0x%x\r\n", (int)ntohs(p.Key.keycode), (int)ntohs(p.Key.meta));
-			input.push_back(KeyDown(MapKeycode((ANDROID_KEYCODE)ntohs(p.Key.keycode))));
-			input.push_back(KeyUp(MapKeycode((ANDROID_KEYCODE)ntohs(p.Key.keycode))));
+		case GE_ZOOM:
+			input.push_back(KeyDown(VK_CONTROL));
+			input.push_back(MouseWheel(g.dy));
+			input.push_back(KeyUp(VK_CONTROL));
 			break;
-		case C_KEYDOWN:	
-			Log(OL_VERBOSE, L"KEYDOWN %i 0x%x\r\n", (int)ntohs(p.Key.keycode), (int)ntohs(p.Key.meta));
-			input.push_back(KeyDown(MapKeycode((ANDROID_KEYCODE)ntohs(p.Key.keycode))));
+		case GE_BUTTONDOWN: 
+			input.push_back(MouseButtonDown(g.dx)); 
 			break;
-		case C_KEYUP:
-			Log(OL_VERBOSE, L"KEYUP %i 0x%x\r\n", (int)ntohs(p.Key.keycode), (int)ntohs(p.Key.meta));
-			input.push_back(KeyUp(MapKeycode((ANDROID_KEYCODE)ntohs(p.Key.keycode))));
+		case GE_BUTTONUP: 
+			input.push_back(MouseButtonUp(g.dx)); 
 			break;
+		}
+	}
+}
+
+// The modifier a left or right modifier key is, or vk if it isn't one.
+static WORD Modifier(WORD vk)
+{
+	switch(vk)
+	{
+	case VK_LSHIFT: case VK_RSHIFT: return VK_SHIFT;
+	case VK_LCONTROL: case VK_RCONTROL: return VK_CONTROL;
+	case VK_LMENU: case VK_RMENU: return VK_MENU;
+	case VK_RWIN: return VK_LWIN;
+	default: return vk;
+	}
+}
+
+// Whether a modifier is held once an input batch is injected. GetAsyncKeyState
+// doesn't see the keys in the batch yet, so the last of them decides.
+static bool IsHeld(const std::vector < INPUT > & input, WORD modifier)
+{
+	for(std::size_t i = input.size(); i > 0; --i)
+	{
+		const INPUT & in = input[i - 1];
+		if(in.type == INPUT_KEYBOARD && (in.ki.dwFlags & KEYEVENTF_UNICODE) == 0 && Modifier(in.ki.wVk) == modifier)
+			return (in.ki.dwFlags & KEYEVENTF_KEYUP) == 0;
+	}
+	return (GetAsyncKeyState(modifier) & 0x8000) != 0;
+}
+
+// Append key presses to an input batch, wrapped in the modifiers that aren't
+// already held.
+void AppendKey(std::vector < INPUT > & input, WORD vk, int modifiers, int repeat)
+{
+	static const WORD Modifiers[] = { VK_SHIFT, VK_CONTROL, VK_MENU, VK_LWIN };
+	const int count = sizeof(Modifiers) / sizeof(Modifiers[0]);
+
+	int wrap = 0;
+	for(int i = 0; i < count; ++i)
+	{
+		if((modifiers & (1 << i)) && !IsHeld(input, Modifiers[i]))
+		{
+			wrap |= 1 << i;
+			input.push_back(KeyDown(Modifiers[i]));
+		}
+	}
+	for(int i = 0; i < repeat; ++i)
+	{
+		input.push_back(KeyDown(vk));
+		input.push_back(KeyUp(vk));
+	}
+	for(int i = count - 1; i >= 0; --i)
+	{
+		if(wrap & (1 << i))
+			input.push_back(KeyUp(Modifiers[i]));
+	}
+}
+
+// Append a UTF-16 string to an input batch.
+void AppendText(std::vector < INPUT > & input, const wchar_t * text, int length)
+{
+	for(int i = 0; i < length; ++i)
+	{
+		WORD ch = text[i];
+		if(IS_HIGH_SURROGATE(ch))
+		{
+			// Both halves of a surrogate pair must be adjacent in the batch.
+			if(i + 1 < length && IS_LOW_SURROGATE(text[i + 1]))
+			{
+				WORD low = text[++i];
+				input.push_back(CharDown(ch));
+				input.push_back(CharDown(low));
+				input.push_back(CharUp(ch));
+				input.push_back(CharUp(low));
+			}
+		}
+		else if(!IS_LOW_SURROGATE(ch))
+		{
+			input.push_back(CharDown(ch));
+			input.push_back(CharUp(ch));
+		}
+	}
+}
+
+// Read from the client stream. When everything received has been read, receives 
+// as much as is waiting with one call.
+int Server::ReceiveStream(void * buffer, int size, int timeout)
+{
+	if(streamAt == streamEnd)
+	{
+		streamAt = 0;
+		streamEnd = client.Receive(stream, sizeof(stream), timeout);
+	}
+	int n = std::min(size, streamEnd - streamAt);
+	memcpy(buffer, stream + streamAt, n);
+	streamAt += n;
+	return n;
+}
+
+// Receive the payload following a variable length packet.
+bool Server::ReceivePayload(void * buffer, int size)
+{
+	// Local packets carry their payload in the same record.
+	if(localPayload)
+	{
+		if(size > localRemaining)
+			return false;
+		memcpy(buffer, localPayload, size);
+		localPayload += size;
+		localRemaining -= size;
+		return true;
+	}
+
+	// The waits in a pass share one deadline, however many packets are split.
+	char * at = (char *)buffer;
+	while(size > 0)
+	{
+		int received = ReceiveStream(at, size, 10);
+		at += received;
+		size -= received;
+		if(size > 0 && Time() > payloadDeadline)
+			return false;
+	}
+	return true;
+}
+
+__int64 Server::ClientTime()
+{
+	if(rtt < 0)
+		return -1;
+	return Microseconds() - clockOffset;
+}
+
+// Inject each motion sample as its own move, so nothing the touchscreen reported 
+// is lost. Fractions of a pixel carry over to the next sample instead of being 
+// rounded away, and the moves are stamped with the samples' spacing in time.
+void Server::AppendMotion(const MotionSample * samples, int count, std::vector < INPUT > & input)
+{
+	if(count <= 0)
+		return;
+
+	DWORD now = GetTickCount();
+	unsigned short last = ntohs(samples[count - 1].Time);
+	for(int i = 0; i < count; ++i)
+	{
+		motionX += (short)ntohs(samples[i].dx);
+		motionY += (short)ntohs(samples[i].dy);
+		int dx = motionX / MotionScale;
+		int dy = motionY / MotionScale;
+		if(dx == 0 && dy == 0)
+			continue;
+		motionX -= dx * MotionScale;
+		motionY -= dy * MotionScale;
+
+		INPUT move = MouseMove(dx, dy);
+		unsigned short age = last - ntohs(samples[i].Time);
+		if(age < 1000)
+			move.mi.time = now - age;
+		input.push_back(move);
+	}
+}
+
+void Server::HandleHello(const Packet & p)
+{
+	clientCapabilities = ntohs(p.Hello.capabilities) & ServerCapabilities;
+	Log(OL_VERBOSE, L"HELLO %x\r\n", clientCapabilities);
+
+	// The client reads replies from now on. The socket is empty this early, and
+	// the macro list is capped so it fits.
+	Packet reply;
+	reply.Control = C_HELLO;
+	reply.Hello.capabilities = htons(ServerCapabilities);
+	reply.Hello.window = htons(clientCapabilities & CAP_CREDITS ? CreditWindow : 0);
+	client.Send(&reply, sizeof(reply));
+	if(clientCapabilities & CAP_MACROS)
+		SendMacros(client);
+}
+
+void Server::HandleClock(const Packet & p)
+{
+	__int64 received = Microseconds();
+
+	if(ntohs(p.Length) != sizeof(ClockSync))
+		throw socket_exception("Server::HandleClock", WSAEMSGSIZE);
+	ClockSync sync;
+	if(!ReceivePayload(&sync, sizeof(sync)))
+		throw socket_exception("Server::HandleClock", WSAETIMEDOUT);
+
+	// The client estimates the clock offset and round trip time, keep its estimates.
+	rtt = (int)ntohl(sync.Rtt);
+	if(rtt >= 0)
+	{
+		clockOffset = (__int64)Swap64(sync.Offset);
+		Gauge(M_RTT_US, rtt);
+		Gauge(M_CLOCK_OFFSET_MS, (long)(clockOffset / 1000));
+	}
+	Count(M_CLOCK_SYNCS);
+	Log(OL_VERBOSE, L"CLOCK %i us\r\n", rtt);
+
+	// Reply with the server timestamps.
+	char reply[sizeof(Packet) + sizeof(ClockSync)];
+	sync.Receive = Swap64(received);
+	sync.Transmit = Swap64(Microseconds());
+	memcpy(reply, &p, sizeof(Packet));
+	memcpy(reply + sizeof(Packet), &sync, sizeof(sync));
+	try
+	{
+		client.Send(reply, sizeof(reply));
+	}
+	catch(socket_exception & ex)
+	{
+		// The client isn't reading, skip this sample rather than drop the client.
+		if(ex.error() != WSAEWOULDBLOCK)
+			throw;
+		Log(OL_VERBOSE, L"Clock reply dropped\r\n");
+	}
+}
+
+void Server::HandleGamepad(const Packet & p)
+{
+	if(ntohs(p.Length) != sizeof(GamepadState))
+		throw socket_exception("Server::HandleGamepad", WSAEMSGSIZE);
+	GamepadState s;
+	if(!ReceivePayload(&s, sizeof(s)))
+		throw socket_exception("Server::HandleGamepad", WSAETIMEDOUT);
+
+	s.Sequence = ntohs(s.Sequence);
+	s.Buttons = ntohs(s.Buttons);
+	s.LeftX = ntohs(s.LeftX);
+	s.LeftY = ntohs(s.LeftY);
+	s.RightX = ntohs(s.RightX);
+	s.RightY = ntohs(s.RightY);
+
+	// Snapshots are full states, keep only the newest.
+	if(!gamepadPending || (short)(s.Sequence - gamepadState.Sequence) > 0)
+	{
+		gamepadState = s;
+		gamepadPending = true;
+	}
+}
+
+void Server::HandleClipboard(const Packet & p)
+{
+	int length = ntohs(p.Clip.length);
+	if(length > MaxClipboardChunk)
+		throw socket_exception("Server::HandleClipboard", WSAEMSGSIZE);
+
+	if(p.Clip.flags & CLIP_BEGIN)
+	{
+		clipboardData.clear();
+		clipboardFormat = p.Clip.format;
+		clipboardReceiving = true;
+	}
+
+	// Read the chunk even if the transfer is being dropped, to stay in sync.
+	std::size_t at = clipboardData.size();
+	clipboardData.resize(at + length);
+	if(length > 0 && !ReceivePayload(&clipboardData[at], length))
+		throw socket_exception("Server::HandleClipboard", WSAETIMEDOUT);
+	Count(M_CLIPBOARD_BYTES, length);
+	Log(OL_VERBOSE, L"CLIPBOARD %i 0x%x\r\n", length, (int)p.Clip.flags);
+
+	if(!clipboardReceiving || clipboardData.size() > MaxClipboardSize)
+	{
+		if(clipboardReceiving)
+			Log(OL_WARNING, L"Clipboard transfer is too large\r\n");
+		clipboardReceiving = false;
+		std::vector < char > ().swap(clipboardData);
+		return;
+	}
+
+	if(p.Clip.flags & CLIP_END)
+	{
+		if(clipboard->Set(clipboardFormat, clipboardData))
+			Log(OL_INFO, L"Clipboard set, %u bytes\r\n", (unsigned)clipboardData.size());
+		else
+			Log(OL_WARNING, L"Failed to set the clipboard\r\n");
+		Count(M_CLIPBOARDS);
+		clipboardReceiving = false;
+		std::vector < char > ().swap(clipboardData);
+	}
+}
+
+void Server::ReleaseGamepad()
+{
+	input.clear();
+	gamepad.Release(input);
+	if(!input.empty())
+		SendInput(input.size(), &input[0], sizeof(input[0]));
+	Log(OL_VERBOSE, L"Gamepad released\r\n");
+}
+
+void Server::LoadMacros(const wchar_t * path)
+{
+	macros.Load(path);
+}
+
+void Server::SetClipboard(Clipboard * backend)
+{
+	delete clipboard;
+	clipboard = backend;
+}
 
-		case C_NULL:
-			Log(OL_VERBOSE, L"NULL %i\r\n", ntohl(p.Count));
+void Server::InjectFault(SERVER_FAULT fault)
+{
+	InterlockedExchange(&this->fault, fault);
+}
+
+void Server::Recover()
+{
+	// The thread has exited, this only cleans up after it.
+	Thread::Stop();
+
+	// The client can stay connected if its stream is still at a packet boundary.
+	if(client.IsValid() && clientPartial)
+	{
+		client.Close();
+		Log(OL_WARNING, L"Client dropped by the restart\r\n");
+	}
+	clientPartial = false;
+	fault = SF_NONE;
+	localPayload = NULL;
+	localRemaining = 0;
+	input.clear();
+
+	Thread::Run();
+	Count(M_RESTARTS);
+	Log(OL_NOTIFY | OL_WARNING, L"Server thread exited, restarted (%li restarts)\r\n", Metric(M_RESTARTS));
+}
+
+// Send the macro names to a client, separated by newlines.
+void Server::SendMacros(TcpSocket & to)
+{
+	// Names are listed in the order of their ids, so the list stops at the 
+	// first whole name that doesn't fit.
+	std::wstring names;
+	for(std::size_t i = 0; i < macros.Count(); ++i)
+	{
+		std::size_t size = names.size() + (i > 0 ? 1 : 0) + macros[i].Name.size();
+		if(size > (std::size_t)MaxMacroList)
+		{
+			Log(OL_WARNING, L"Macro list too long, sent %i of %i\r\n", (int)i, (int)macros.Count());
 			break;
-		
-		case C_DISCONNECT:
-			Log(OL_VERBOSE, L"DISCONNECT\r\n");
-			client.Close();
-			Log(OL_NOTIFY | OL_INFO, L"Client disconnected\r\n");
+		}
+		if(i > 0)
+			names += '\n';
+		names += macros[i].Name;
+	}
+
+	std::vector < char > buffer(sizeof(Packet) + names.size() * sizeof(wchar_t));
+	Packet & p = *(Packet *)&buffer[0];
+	p.Control = C_MACROS;
+	p.Length = htons((unsigned short)names.size());
+	wchar_t * text = (wchar_t *)&buffer[sizeof(Packet)];
+	for(std::size_t i = 0; i < names.size(); ++i)
+		text[i] = htons(names[i]);
+	to.Send(&buffer[0], buffer.size());
+}
+
+void Server::RunMacro(int id, std::vector < INPUT > & input)
+{
+	if(id < 0 || id >= (int)macros.Count())
+	{
+		Log(OL_WARNING, L"Unknown macro %i\r\n", id);
+		return;
+	}
+
+	// Triggers come back faster than long macros finish, so only a few wait.
+	if((int)macroQueue.size() >= MaxMacroQueue)
+	{
+		Log(OL_WARNING, L"Macro queue full, dropped macro %i\r\n", id);
+		return;
+	}
+	macroQueue.push_back(id);
+	StepMacro(input);
+}
+
+// Append the macro steps that are due to the batch.
+void Server::StepMacro(std::vector < INPUT > & input)
+{
+	while(Time() >= macroDue)
+	{
+		if(macro < 0)
+		{
+			if(macroQueue.empty())
+				return;
+			macro = macroQueue.front();
+			macroQueue.erase(macroQueue.begin());
+			macroStep = 0;
+		}
+
+		const MacroStep & step = macros[macro].Steps[macroStep++];
+		input.insert(input.end(), step.Input.begin(), step.Input.end());
+		macroDue = Time() + step.Delay * Frequency() / 1000;
+		if(macroStep >= macros[macro].Steps.size())
+			macro = -1;
+	}
+}
+
+// Handle one packet, appending any input to the batch.
+void Server::HandlePacket(const Packet & p, std::vector < INPUT > & input)
+{
+	switch(p.Control)
+	{
+	case C_MOUSE_MOVE:		
+		Log(OL_VERBOSE, L"MOUSE_MOVE %i %i\r\n", (int)p.Delta2D.dx, (int)p.Delta2D.dy);
+		input.push_back(MouseMove(p.Delta2D.dx, p.Delta2D.dy));
+		break;
+	case C_MOUSE_MOVES:
+		{
+			int count = p.Motion.count;
+			if(count > MaxMotionSamples)
+				throw socket_exception("Server::HandlePacket", WSAEMSGSIZE);
+			MotionSample samples[MaxMotionSamples];
+			if(count > 0 && !ReceivePayload(samples, count * sizeof(MotionSample)))
+				throw socket_exception("Server::HandlePacket", WSAETIMEDOUT);
+			Log(OL_VERBOSE, L"MOUSE_MOVES %i\r\n", count);
+			AppendMotion(samples, count, input);
+		}
+		break;
+	case C_MOUSE_BUTTONDOWN:
+		Log(OL_VERBOSE, L"MOUSE_BUTTONDOWN %i\r\n", (int)p.Button);
+		input.push_back(MouseButtonDown(p.Button));
+		break;
+	case C_MOUSE_BUTTONUP:
+		Log(OL_VERBOSE, L"MOUSE_BUTTONUP %i\r\n", (int)p.Button);
+		input.push_back(MouseButtonUp(p.Button));
+		break;
+	case C_MOUSE_SCROLL:
+		Log(OL_VERBOSE, L"MOUSE_SCROLL %i\r\n", (int)p.Delta);
+		input.push_back(MouseWheel(p.Delta));
+		break;
+	case C_MOUSE_SCROLL2:
+		Log(OL_VERBOSE, L"MOUSE_SCROLL2 %i %i\r\n", (int)p.Delta2D.dx, (int)p.Delta2D.dy);
+		if(p.Delta2D.dx != 0)
+			input.push_back(MouseHWheel(p.Delta2D.dx));
+		if(p.Delta2D.dy != 0)
+			input.push_back(MouseWheel(p.Delta2D.dy));
+		break;
+	case C_TOUCH:
+		{
+			int count = p.Touch.count;
+			std::vector < TouchPoint > points(count + 1);
+			if(!ReceivePayload(&points[0], count * sizeof(TouchPoint)))
+				throw socket_exception("Server::HandlePacket", WSAETIMEDOUT);
+			Log(OL_VERBOSE, L"TOUCH %i\r\n", count);
+
+			gestures.Mode = p.Touch.mode;
+			gestures.Scale = ntohs(p.Touch.scale) / 256.0f;
+
+			std::vector < Gesture > recognized;
+			for(int i = 0; i < count; ++i)
+			{
+				TouchSample s;
+				s.Pointer = points[i].Pointer;
+				s.Action = points[i].Action;
+				s.x = (short)ntohs(points[i].x);
+				s.y = (short)ntohs(points[i].y);
+				s.Time = ntohs(points[i].Time);
+				gestures.Touch(s, recognized);
+			}
+
+			// One way latency of the newest sample, touch times are in client milliseconds.
+			__int64 now = ClientTime();
+			if(now >= 0 && count > 0)
+				Gauge(M_TOUCH_LATENCY_US, (unsigned short)(now / 1000 - ntohs(points[count - 1].Time)) * 1000);
+			AppendGestures(input, recognized);
+		}
+		break;
+	
+	case C_CHAR:
+		Log(OL_VERBOSE, L"CHAR %c\r\n", ntohs(p.Char));
+		input.push_back(CharDown(ntohs(p.Char)));
+		input.push_back(CharUp(ntohs(p.Char)));
+		break;
+	case C_TEXT:
+		{
+			int length = ntohs(p.Length);
+			if(length > MaxTextLength)
+				throw socket_exception("Server::HandlePacket", WSAEMSGSIZE);
+
+			std::vector < wchar_t > text(length + 1, 0);
+			if(!ReceivePayload(&text[0], length * sizeof(wchar_t)))
+				throw socket_exception("Server::HandlePacket", WSAETIMEDOUT);
+			for(int i = 0; i < length; ++i)
+				text[i] = ntohs(text[i]);
+
+			Log(OL_VERBOSE, L"TEXT %s\r\n", &text[0]);
+			AppendText(input, &text[0], length);
+		}
+		break;
+	case C_COMPOSE:
+		{
+			// An edit to the text being composed by the keyboard: backspaces
+			// and the new text, injected together.
+			int deleted = ntohs(p.Compose.deleted);
+			int length = ntohs(p.Compose.length);
+			if(deleted > MaxTextLength || length > MaxTextLength)
+				throw socket_exception("Server::HandlePacket", WSAEMSGSIZE);
+
+			std::vector < wchar_t > text(length + 1, 0);
+			if(length > 0 && !ReceivePayload(&text[0], length * sizeof(wchar_t)))
+				throw socket_exception("Server::HandlePacket", WSAETIMEDOUT);
+			for(int i = 0; i < length; ++i)
+				text[i] = ntohs(text[i]);
+
+			Log(OL_VERBOSE, L"COMPOSE -%i %s\r\n", deleted, &text[0]);
+			AppendKey(input, VK_BACK, 0, deleted);
+			AppendText(input, &text[0], length);
+		}
+		break;
+	case C_KEYPRESS:	
+		Log(OL_VERBOSE, L"KEYPRESS %i 0x%x\r\n", (int)ntohs(p.Key.keycode), (int)ntohs(p.Key.meta));
+		input.push_back(KeyDown(MapKeycode((ANDROID_KEYCODE)ntohs(p.Key.keycode))));
+		input.push_back(KeyUp(MapKeycode((ANDROID_KEYCODE)ntohs(p.Key.keycode))));
+		break;
+	case C_KEY:
+		Log(OL_VERBOSE, L"KEY %i 0x%x x%i\r\n", (int)ntohs(p.KeyEvent.keycode), (int)p.KeyEvent.modifiers, (int)p.KeyEvent.repeat);
+		AppendKey(input, MapKeycode((ANDROID_KEYCODE)ntohs(p.KeyEvent.keycode)), p.KeyEvent.modifiers, std::max(1, (int)p.KeyEvent.repeat));
+		break;
+	case C_KEYDOWN:	
+		Log(OL_VERBOSE, L"KEYDOWN %i 0x%x\r\n", (int)ntohs(p.Key.keycode), (int)ntohs(p.Key.meta));
+		input.push_back(KeyDown(MapKeycode((ANDROID_KEYCODE)ntohs(p.Key.keycode))));
+		break;
+	case C_KEYUP:
+		Log(OL_VERBOSE, L"KEYUP %i 0x%x\r\n", (int)ntohs(p.Key.keycode), (int)ntohs(p.Key.meta));
+		input.push_back(KeyUp(MapKeycode((ANDROID_KEYCODE)ntohs(p.Key.keycode))));
+		break;
+
+	case C_GAMEPAD:
+		HandleGamepad(p);
+		break;
+
+	case C_CLIPBOARD:
+		HandleClipboard(p);
+		break;
+
+	case C_MACRO:
+		Log(OL_VERBOSE, L"MACRO %i\r\n", (int)ntohs(p.Macro));
+		RunMacro(ntohs(p.Macro), input);
+		break;
+
+	case C_NULL:
+		Log(OL_VERBOSE, L"NULL %i\r\n", ntohl(p.Count));
+		break;
+	case C_CLOCK:
+		HandleClock(p);
+		break;
+	case C_HELLO:
+		HandleHello(p);
+		break;
+	
+	case C_DISCONNECT:
+		Log(OL_VERBOSE, L"DISCONNECT\r\n");
+		client.Close();
+		Log(OL_NOTIFY | OL_INFO, L"Client disconnected\r\n");
+		break;
+	case C_SUSPEND:
+		Log(OL_VERBOSE, L"SUSPEND\r\n");
+		client.Close();
+		Log(OL_INFO, L"Client suspended\r\n");
+		break;
+	default:
+		Log(OL_VERBOSE, L"UNKNOWN\r\n");
+		break;
+	}
+}
+
+void Server::InjectInput()
+{
+	if(!input.empty())
+	{
+		Count(M_INPUTS, input.size());
+		Count(M_SENDINPUTS);
+		if(SendInput(input.size(), &input[0], sizeof(input[0])) != input.size())
+			Log(OL_ERROR, L"SendInput Failed!\r\n");
+
+		// The batch outgrew the locked pages and moved, lock where it is now.
+		if(lowLatencyEnabled && input.capacity() > inputLocked)
+		{
+			UnlockMemory(inputLockedAt, inputLocked * sizeof(INPUT));
+			inputLocked = input.capacity();
+			input.resize(inputLocked);
+			inputLockedAt = &input[0];
+			if(!LockMemory(inputLockedAt, inputLocked * sizeof(INPUT)))
+				Log(OL_WARNING, L"Failed to lock input batch\r\n");
+		}
+		input.clear();
+	}
+}
+
+void Server::Serviced(TRAFFIC_CLASS c, __int64 ready)
+{
+	long us = (long)((Time() - ready) * 1000000 / Frequency());
+	Gauge(Latency[c], us);
+	if(c == TC_BUTTON || c == TC_MOTION)
+	{
+		Peak(M_INPUT_LATENCY_MAX_US, us);
+		if(us > InputTarget)
+			Count(M_INPUT_LATE);
+	}
+}
+
+bool Server::HandlePackets()
+{
+	input.clear();
+
+	// Handle the packets that have arrived, within the client budgets, then inject 
+	// the input in one batch. Buttons don't wait for the rest of the batch, the 
+	// input up to and including them is injected immediately.
+	Packet p;
+	int consumed = 0;
+	int served[TC_COUNT] = { 0 };
+	__int64 ready = 0;
+	bool drained = false;
+	while(client.IsValid())
+	{
+		if(served[TC_BUTTON] >= Budget[TC_BUTTON] || served[TC_MOTION] >= Budget[TC_MOTION] || served[TC_BULK] >= Budget[TC_BULK])
 			break;
-		case C_SUSPEND:
-			Log(OL_VERBOSE, L"SUSPEND\r\n");
-			client.Close();
-			Log(OL_INFO, L"Client suspended\r\n");
+
+		int received = ReceiveStream(&p, sizeof(p));
+		if(received <= 0)
+		{
+			drained = true;
 			break;
-		default:
-			Log(OL_VERBOSE, L"UNKNOWN\r\n");
+		}
+		clientPartial = true;
+		if(received < (int)sizeof(p) && !ReceivePayload((char *)&p + received, sizeof(p) - received))
+			throw socket_exception("Server::HandlePackets", WSAETIMEDOUT);
+
+		// The first packet arrived while waiting for it, or it may have been 
+		// waiting since the socket was last drained.
+		if(consumed == 0)
+			ready = std::max(idle[TC_MOTION], woke);
+
+		HandlePacket(p, input);
+		clientPartial = false;
+		Count(M_PACKETS);
+		++consumed;
+
+		TRAFFIC_CLASS c = Classify(p);
+		++served[c];
+		if(c == TC_BUTTON)
+		{
+			InjectInput();
+			Serviced(TC_BUTTON, ready);
+		}
+	}
+
+	AppendPending();
+	InjectInput();
+	if(served[TC_MOTION] > 0)
+		Serviced(TC_MOTION, ready);
+	if(served[TC_BULK] > 0)
+		Serviced(TC_BULK, ready);
+	// Input left over the budget has been waiting since before this pass.
+	if(drained)
+		idle[TC_BUTTON] = idle[TC_MOTION] = Time();
+
+	// Return the credits for the packets consumed now that their input is injected, 
+	// so a slow SendInput holds the client back instead of filling the socket.
+	if(consumed > 0 && client.IsValid() && (clientCapabilities & CAP_CREDITS))
+	{
+		Packet credit;
+		credit.Control = C_CREDIT;
+		credit.Count = htonl(consumed);
+		client.Send(&credit, sizeof(credit));
+		Count(M_CREDITS, consumed);
+	}
+	return drained;
+}
+
+bool Server::HandleLocal()
+{
+	input.clear();
+
+	// Local packets go through the same decoder as the client's. Control packets
+	// act on the client connection, so they are ignored, and so are clipboard
+	// transfers and touches, whose state spans the client's packets. Motion 
+	// swaps in the local remainder.
+	std::swap(motionX, localMotionX);
+	std::swap(motionY, localMotionY);
+	char record[LocalInputRecord];
+	bool drained = false;
+	for(int n = 0; n < LocalBudget; ++n)
+	{
+		int size = local.Read(record, sizeof(record));
+		if(size <= 0)
+		{
+			drained = true;
 			break;
 		}
-		if(!input.empty() && SendInput(input.size(), &input[0], sizeof(input[0])) != input.size())
-			Log(OL_ERROR, L"SendInput Failed!\r\n");
+		if(size < (int)sizeof(Packet))
+			continue;
+
+		const Packet & p = *(const Packet *)record;
+		if(p.Control < C_MOUSE_MOVE || p.Control == C_CLIPBOARD || p.Control == C_TOUCH)
+		{
+			Log(OL_VERBOSE, L"Ignoring local packet %i\r\n", (int)p.Control);
+			continue;
+		}
+
+		localPayload = record + sizeof(Packet);
+		localRemaining = size - sizeof(Packet);
+		try
+		{
+			HandlePacket(p, input);
+		}
+		catch(socket_exception & ex)
+		{
+			Log(OL_WARNING, L"Bad local packet: %S\r\n", ex.what());
+		}
+		localPayload = NULL;
+		Count(M_LOCAL_PACKETS);
+	}
+	std::swap(motionX, localMotionX);
+	std::swap(motionY, localMotionY);
+
+	AppendPending();
+	InjectInput();
+	return drained;
+}
+
+void Server::AppendPending()
+{
+	// Apply only the newest gamepad state. It is released if the snapshots stop.
+	if(gamepadPending)
+	{
+		Log(OL_VERBOSE, L"GAMEPAD %i 0x%x\r\n", gamepadState.Sequence, gamepadState.Buttons);
+		gamepad.Apply(gamepadState, input);
+		gamepadPending = false;
+		gamepadTimeout = Time() + Frequency() / 2;
 	}
 }
 
 void Server::AcceptClients()
 {
-	TcpSocket c;
-	Address from;
-	if(c.Accept(server, from, false))
+	// Accept one connection at a time. Its handshake is read over the following 
+	// passes, so a slow client doesn't hold up input.
+	if(!handshake.IsValid())
 	{
-		std::wstring name = c.GetPeer().ToString(false);
+		if(!handshake.Accept(server, handshakeFrom, false))
+		{
+			idle[TC_HANDSHAKE] = Time();
+			return;
+		}
+		// The accepted socket inherits the listener's network events.
+		handshake.Watch(network, FD_READ | FD_CLOSE);
+		handshakeReceived = 0;
+		handshakeStart = Time();
+	}
 
-		// Check password.
-		Packet p;
-		if(c.Receive(&p, sizeof(p), 1000) == sizeof(p) && (p.Control == C_CONNECT || p.Control == C_RESUME))
+	bool closed = false;
+	try
+	{
+		handshakeReceived += handshake.Receive((char *)&handshakePacket + handshakeReceived, sizeof(Packet) - handshakeReceived);
+		closed = handshakeReceived < (int)sizeof(Packet) && handshake.IsClosed();
+	}
+	catch(socket_exception &)
+	{
+		handshake.Close();
+		throw;
+	}
+	// Wait up to a second for the client to say something.
+	if(handshakeReceived < (int)sizeof(Packet) && !closed && Time() - handshakeStart < Frequency())
+		return;
+
+	TcpSocket c;
+	c.Take(handshake);
+	std::wstring name = handshakeFrom.ToString(false);
+
+	// Check password.
+	Packet p = handshakePacket;
+	if(handshakeReceived == sizeof(Packet) && (p.Control == C_CONNECT || p.Control == C_RESUME))
+	{
+		if(password == 0 || password == ntohl(p.Password))
 		{
-			if(password == 0 || password == ntohl(p.Password))
+			// Check if a client is being booted by the new client.
+			if(client.IsValid())
 			{
-				// Check if a client is being booted by the new client.
-				if(client.IsValid())
-				{
-					std::wstring name = client.GetPeer().ToString(false);
+				std::wstring name = client.GetPeer().ToString(false);
 
-					client.Close();
-					if(p.Control != C_RESUME)
-						Log(OL_INFO, L"Replacing client %s\r\n", name.c_str());
+				// Tell it why, so it doesn't reconnect and boot the new client in turn.
+				Packet bye = { 0 };
+				bye.Control = C_DISCONNECT;
+				bye.Reason = DR_REPLACED;
+				try
+				{
+					client.Send(&bye, sizeof(bye));
 				}
-
-				if(p.Control == C_CONNECT)
-					Log(OL_NOTIFY | OL_INFO, L"Client connected from %s\r\n", name.c_str());
-				else
-					Log(OL_INFO, L"Client resumed\r\n");
-				p.Control = C_CONNECT;
-				c.Send(&p, sizeof(p));
-
-				client.Take(c);
+				catch(socket_exception &)
+				{
+				}
+				client.Close();
+				if(p.Control != C_RESUME)
+					Log(OL_INFO, L"Replacing client %s\r\n", name.c_str());
 			}
+
+			if(p.Control == C_CONNECT)
+				Log(OL_NOTIFY | OL_INFO, L"Client connected from %s\r\n", name.c_str());
 			else
-			{
-				p.Control = C_DISCONNECT;
-				p.Reason = 1;
-				Log(OL_INFO, L"Rejected client %s: Bad password\r\n", name.c_str());
-			}
+				Log(OL_INFO, L"Client resumed\r\n");
+			// The reply echoes the handshake. Credits and macros wait for C_HELLO.
+			p.Control = C_CONNECT;
+			c.Send(&p, sizeof(p));
+
+			client.Take(c);
+			clientCapabilities = 0;
+			streamAt = streamEnd = 0;
+			gestures.Reset();
+			motionX = motionY = 0;
+			// A transfer cut off with the old connection is abandoned.
+			clipboardReceiving = false;
+			std::vector < char > ().swap(clipboardData);
+			rtt = -1;
+			idle[TC_BUTTON] = idle[TC_MOTION] = Time();
+			Count(M_CLIENTS);
 		}
 		else
 		{
 			p.Control = C_DISCONNECT;
-			p.Reason = 0;
-			Log(OL_INFO, L"Client failed to connect from %s\r\n", name.c_str());
-		}
-		if(p.Control == C_DISCONNECT)
-		{
-			c.Send(&p, sizeof(p));
-			c.Close();
+			p.Reason = DR_PASSWORD;
+			Count(M_REJECTED);
+			Log(OL_INFO, L"Rejected client %s: Bad password\r\n", name.c_str());
 		}
 	}
+	else
+	{
+		p.Control = C_DISCONNECT;
+		p.Reason = DR_HANDSHAKE;
+		Log(OL_INFO, L"Client failed to connect from %s\r\n", name.c_str());
+	}
+	if(p.Control == C_DISCONNECT && !closed)
+		c.Send(&p, sizeof(p));
+
+	Serviced(TC_HANDSHAKE, idle[TC_HANDSHAKE]);
+	idle[TC_HANDSHAKE] = Time();
 }
 
-void Server::CheckBeacon(int i)
+bool Server::CheckBeacon(int i)
 {
 	Address from;
 	Packet p;
-	while(beacons[i].ReceiveFrom(&p, sizeof(p), from) == sizeof(p))
+	for(int n = 0; n < Budget[TC_DISCOVERY]; ++n)
 	{
+		if(beacons[i].ReceiveFrom(&p, sizeof(p), from) != sizeof(p))
+			return true;
+
 		if(p.Control == C_PING)
 		{
 			// Reply with port the server is running on.
 			p.Control = C_ACK;
 			p.Port = htons(port);
 			beacons[i].SendTo(&p, sizeof(p), from);
+			Count(M_BEACONS);
+			Serviced(TC_DISCOVERY, idle[TC_DISCOVERY]);
 
 			std::wstring name = from.ToString(false);
 			Log(OL_INFO, L"Responded to broadcast from %s\r\n", name.c_str());
 		}
 	}
+	// Leave the rest for the next pass.
+	return false;
 }
 
 void Server::Main(const volatile bool & run)
 {
+	if(lowLatency)
+		EnableLowLatency();
+	try
+	{
+		Serve(run);
+	}
+	catch(...)
+	{
+		// Don't leave the thread registered with MMCSS when it dies.
+		DisableLowLatency();
+		throw;
+	}
+	DisableLowLatency();
+}
+
+void Server::Serve(const volatile bool & run)
+{
+	for(int i = 0; i < TC_COUNT; ++i)
+		idle[i] = Time();
+
+	// Serve the traffic classes in priority order, each within its budget. 
+	// Only wait when the last pass left nothing waiting.
+	bool drained = true;
 	while(run)
 	{
+		// Only this thread writes the heartbeat.
+		heartbeat++;
+
+		if(fault != SF_NONE)
+		{
+			LONG f = InterlockedExchange(&fault, SF_NONE);
+			if(f == SF_THROW)
+				throw std::runtime_error("Server::Main: injected fault");
+			if(f == SF_STALL)
+				Sleep(FaultStall);
+		}
+
+		// One wait for the sockets and local input. It times out so macros,
+		// the gamepad and handshakes are checked while nothing arrives.
+		woke = 0;
+		if(drained)
+		{
+			HANDLE events[2] = { network, local.Doorbell() };
+			if(WaitForMultipleObjects(local.IsOpen() ? 2 : 1, events, FALSE, 10) != WAIT_TIMEOUT)
+				woke = Time();
+			ResetEvent(network);
+		}
+		drained = true;
+		payloadDeadline = Time() + PayloadTimeout * Frequency() / 1000;
+
+		if(reconfigured)
+			ApplyConfiguration();
+
 		// Respond to client.
 		if(client.IsValid())
 		{
 			try
 			{
-				HandlePackets();
+				drained = HandlePackets() && drained;
 			}
 			catch(socket_exception & ex)
 			{
 				Log(OL_ERROR, L"%S", ex.what());
 				client.Close();
+				clientPartial = false;
 			}
 		}
-		else
+
+		// Input from local tools.
+		if(local.IsOpen())
+			drained = HandleLocal() && drained;
+
+		// Continue macros waiting on a delay, whether or not anything arrived.
+		if(macro >= 0 || !macroQueue.empty())
 		{
-			Sleep(10);
+			input.clear();
+			StepMacro(input);
+			InjectInput();
 		}
 
+		// Release the gamepad if its snapshots stop, or the client goes away.
+		if(gamepad.IsActive() && Time() > gamepadTimeout)
+			ReleaseGamepad();
+
 		// Maybe accept client.
 		if(server.IsValid())
 		{
@@ -324,13 +1364,14 @@ void Server::Main(const volatile bool & run)
 		}
 
 		// Check for broadcasts looking for the server.
+		bool beaconsDrained = true;
 		for(int i = 0; i < 2; ++i)
 		{
 			if(beacons[i].IsValid())
 			{
 				try
 				{
-					CheckBeacon(i);
+					beaconsDrained = CheckBeacon(i) && beaconsDrained;
 				}
 				catch(socket_exception & ex)
 				{
@@ -338,6 +1379,9 @@ void Server::Main(const volatile bool & run)
 				}
 			}
 		}
+		if(beaconsDrained)
+			idle[TC_DISCOVERY] = Time();
+		drained = beaconsDrained && drained;
 	}
 }
 
@@ -4,9 +4,14 @@
 #include "Socket.h"
 #include "Thread.h"
 #include "Protocol.h"
+#include "Gesture.h"
+#include "Gamepad.h"
+#include "Macro.h"
+#include "LocalInput.h"
+#include "Clipboard.h"
+#include "Supervisor.h"
 
-// Default port to use.
-const int DefaultPort = 2999;
+#include <vector>
 
 // Log output level.
 enum OUTPUT_LEVEL
@@ -23,25 +28,187 @@ enum OUTPUT_LEVEL
 // Log message.
 void Log(int level, const wchar_t * s, ...);
 
+// Work served by the server thread, in priority order.
+enum TRAFFIC_CLASS
+{
+	TC_BUTTON,		// Buttons, keys and text, injected as soon as they arrive.
+	TC_MOTION,		// Everything else from the client, injected at the end of the pass.
+	TC_BULK,		// Clipboard transfers.
+	TC_HANDSHAKE,	// Connecting clients.
+	TC_DISCOVERY,	// Beacon pings.
+
+	TC_COUNT,
+};
+
+// Faults that can be injected into the server thread, to test recovery.
+enum SERVER_FAULT
+{
+	SF_NONE,
+	SF_THROW,		// Throw an exception out of the server thread.
+	SF_STALL,		// Block the server thread past the supervisor's stall timeout.
+};
+
 class Server : public ts::Thread
 {
+	friend class Supervisor;
+
 protected:
 	short port;
-	int password;
+	volatile LONG password;
 
 	ts::TcpSocket client, server;
 	ts::UdpSocket beacons[2];
 
+	// Signaled by network events on all of the sockets, so the server thread 
+	// waits for them and local input with one call. Reset after each wait.
+	HANDLE network;
+	// When the last wait ended, or 0 if the pass didn't wait.
+	__int64 woke;
+
+	// Client stream, received as much at a time as is waiting and decoded from here.
+	char stream[16384];
+	int streamAt, streamEnd;
+	// When this pass stops waiting for the rest of client packets.
+	__int64 payloadDeadline;
+
+	// Listener and beacon opened by Reconfigure, waiting for the server thread.
+	ts::CriticalSection reconfigure;
+	ts::TcpSocket pending;
+	ts::UdpSocket pendingBeacon;
+	short pendingPort;
+	volatile bool reconfigured;
+	// The server is listening for clients. Read by other threads under the 
+	// reconfigure lock, while the server thread swaps the sockets.
+	bool listening;
+
+	// Connection accepted and waiting for its first packet.
+	ts::TcpSocket handshake;
+	ts::Address handshakeFrom;
+	Packet handshakePacket;
+	int handshakeReceived;
+	__int64 handshakeStart;
+
+	// When each traffic class last had no work waiting, to measure service latency.
+	__int64 idle[TC_COUNT];
+
+	GestureRecognizer gestures;
+
+	// Motion from C_MOUSE_MOVES not injected yet, in 1/MotionScale pixels.
+	int motionX, motionY;
+
+	// Newest gamepad snapshot received, applied once per pass.
+	Gamepad gamepad;
+	GamepadState gamepadState;
+	bool gamepadPending;
+	__int64 gamepadTimeout;
+
+	// Macro being run, and the macros waiting for it to finish.
+	MacroTable macros;
+	int macro;
+	std::size_t macroStep;
+	__int64 macroDue;
+	std::vector < int > macroQueue;
+
+	void SendMacros(ts::TcpSocket & to);
+	void RunMacro(int id, std::vector < INPUT > & input);
+	void StepMacro(std::vector < INPUT > & input);
+
+	// Clipboard transfer being received, and where finished transfers go.
+	Clipboard * clipboard;
+	std::vector < char > clipboardData;
+	int clipboardFormat;
+	bool clipboardReceiving;
+
+	// Packets submitted by local tools, and the payload of the one being handled.
+	// Their motion not injected yet is kept apart from the client's.
+	LocalInput local;
+	const char * localPayload;
+	int localRemaining;
+	int localMotionX, localMotionY;
+
+	// Restarts the server thread if it dies, and reports it if it stalls. The 
+	// heartbeat counts passes of the server loop.
+	Supervisor supervisor;
+	volatile LONG heartbeat;
+	volatile LONG fault;
+	// A client packet is partly read, the stream isn't at a packet boundary.
+	bool clientPartial;
+	// Replies the client asked for with C_HELLO. Older clients never read 
+	// their socket, so they are sent nothing they didn't ask for.
+	int clientCapabilities;
+
+	// Restart the server thread after it exits, keeping the sockets and as much 
+	// of the session as is safe.
+	void Recover();
+
+	// Input injected by one pass of HandlePackets.
+	std::vector < INPUT > input;
+
+	bool lowLatency;
+	int lowLatencyCore;
+	// The server thread is running at low latency, and where the locked INPUTs 
+	// of the batch are and how many. The batch is locked again if it grows 
+	// past that. The working set size is restored when it's disabled.
+	bool lowLatencyEnabled;
+	HANDLE lowLatencyTask;
+	const INPUT * inputLockedAt;
+	std::size_t inputLocked;
+	SIZE_T workingSetMinimum, workingSetMaximum;
+
+	// Client clock estimates from the last C_CLOCK exchange.
+	__int64 clockOffset;
+	int rtt;
+
+	// Estimated client time in microseconds, or -1 if the clocks aren't synchronized.
+	__int64 ClientTime();
+
 	void InitSockets();
-	void HandlePackets();
+	int ReceiveStream(void * buffer, int size, int timeout = 0);
+	bool ReceivePayload(void * buffer, int size);
+	void HandlePacket(const Packet & p, std::vector < INPUT > & input);
+	bool HandlePackets();
+	bool HandleLocal();
+	void AppendPending();
+	void InjectInput();
+	void Serviced(TRAFFIC_CLASS c, __int64 ready);
+	void HandleClock(const Packet & p);
+	void HandleHello(const Packet & p);
+	void AppendMotion(const MotionSample * samples, int count, std::vector < INPUT > & input);
+	void HandleGamepad(const Packet & p);
+	void HandleClipboard(const Packet & p);
+	void ReleaseGamepad();
+	void EnableLowLatency();
+	void DisableLowLatency();
 	void AcceptClients();
-	void CheckBeacon(int beacon);
+	bool CheckBeacon(int beacon);
+	void ApplyConfiguration();
 
 	void Main(const volatile bool & run);
+	void Serve(const volatile bool & run);
 
 public:
+	Server();
+	~Server();
+
 	bool IsRunning();
 	bool Run(short port, int password);
+
+	// Run the server thread at real-time priority, pinned to core if core >= 0. 
+	// Takes effect the next time the server is run.
+	void SetLowLatency(bool enable, int core = -1);
+
+	// Add the macros in a config file. Call before running the server.
+	void LoadMacros(const wchar_t * path);
+
+	// Send clipboard transfers to a backend instead of the Windows clipboard. 
+	// Takes ownership of the backend. Call before running the server.
+	void SetClipboard(Clipboard * backend);
+
+	// Change the port or password of a running server without dropping the client.
+	bool Reconfigure(short port, int password);
+
+	// Make the server thread fail on its next pass. The supervisor should restart it.
+	void InjectFault(SERVER_FAULT fault);
 };
 
 #endif
\ No newline at end of file
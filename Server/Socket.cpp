@@ -21,6 +21,11 @@ namespace ts
 		WSACleanup();
 	}
 
+	unsigned __int64 Swap64(unsigned __int64 x)
+	{
+		return ((unsigned __int64)ntohl((u_long)x) << 32) | ntohl((u_long)(x >> 32));
+	}
+
 	// Address
 	Address::Address(short port) : size(sizeof(addr)) 
 	{ 
@@ -33,6 +38,7 @@ namespace ts
 	sockaddr * Address::RefSockAddr()  {  return &addr; }
 	const sockaddr * Address::RefSockAddr() const { return &addr; }
 	int Address::Size() const { return size; }
+	void Address::SetPort(short port) { in.sin_port = htons(port); }
 	
 	std::wstring Address::ToString(bool port) const
 	{
@@ -57,6 +63,13 @@ namespace ts
 		return addr;
 	}
 
+	Address Address::Broadcast(short port)
+	{
+		Address addr(port);
+		addr.in.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+		return addr;
+	}
+
 	// Socket
 	void Socket::IoCtlSocket(long cmd, u_long & mode)
 	{
@@ -72,6 +85,20 @@ namespace ts
 		else mode = 1;
 		IoCtlSocket(FIONBIO, mode);
 	}
+
+	void Socket::Watch(HANDLE event, long events)
+	{
+		if(WSAEventSelect(s, event, events) == SOCKET_ERROR)
+			throw socket_exception("Socket::Watch");
+	}
+
+	long Socket::NetworkEvents(HANDLE event)
+	{
+		WSANETWORKEVENTS events;
+		if(WSAEnumNetworkEvents(s, event, &events) == SOCKET_ERROR)
+			throw socket_exception("Socket::NetworkEvents");
+		return events.lNetworkEvents;
+	}
 	
 	void Socket::Close()
 	{ 
@@ -79,6 +106,14 @@ namespace ts
 		s = INVALID_SOCKET; 
 	}
 
+	void Socket::Take(Socket & other)
+	{
+		assert(!IsValid());
+
+		s = other.s;
+		other.s = INVALID_SOCKET;
+	}
+
 	// TcpSocket
 	void TcpSocket::Listen(const Address & addr, int queue, bool blocking)
 	{
@@ -128,6 +163,28 @@ namespace ts
 		}
 	}
 	
+	void TcpSocket::Connect(const Address & addr, bool blocking)
+	{
+		assert(!IsValid());
+
+		try
+		{
+			s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			if(s == INVALID_SOCKET)
+				throw socket_exception("TcpSocket::Connect");
+			if(connect(s, addr.RefSockAddr(), addr.Size()) == SOCKET_ERROR)
+				throw socket_exception("TcpSocket::Connect");
+
+			if(!blocking)
+				SetBlocking(false);
+		}
+		catch(...)
+		{
+			Close();
+			throw;
+		}
+	}
+	
 	int TcpSocket::Receive(void * buffer, int size, int timeout)
 	{
 		if(timeout > 0)
@@ -164,6 +221,22 @@ namespace ts
 		return result;
 	}
 
+	bool TcpSocket::IsClosed()
+	{
+		char c;
+		int result = recv(s, &c, 1, MSG_PEEK);
+		if(result == SOCKET_ERROR)
+			return WSAGetLastError() != WSAEWOULDBLOCK;
+		return result == 0;
+	}
+
+	void TcpSocket::SetNoDelay(bool nodelay)
+	{
+		BOOL value = nodelay ? TRUE : FALSE;
+		if(setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&value, sizeof(value)) == SOCKET_ERROR)
+			throw socket_exception("TcpSocket::SetNoDelay");
+	}
+
 	Address TcpSocket::GetPeer()
 	{
 		Address addr;
@@ -173,14 +246,6 @@ namespace ts
 		return addr;
 	}
 
-	void TcpSocket::Take(TcpSocket & other)
-	{
-		assert(!IsValid());
-
-		s = other.s;
-		other.s = INVALID_SOCKET;
-	}
-
 	// UdpSocket
 	void UdpSocket::Bind(Address addr, bool blocking)
 	{
@@ -204,6 +269,13 @@ namespace ts
 		}
 	}
 
+	void UdpSocket::SetBroadcast(bool broadcast)
+	{
+		BOOL value = broadcast ? TRUE : FALSE;
+		if(setsockopt(s, SOL_SOCKET, SO_BROADCAST, (const char *)&value, sizeof(value)) == SOCKET_ERROR)
+			throw socket_exception("UdpSocket::SetBroadcast");
+	}
+
 	int UdpSocket::ReceiveFrom(void * buffer, int size, Address & from, int timeout)
 	{
 		if(timeout > 0)
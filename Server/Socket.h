@@ -21,6 +21,9 @@ namespace ts
 	void InitSockets();
 	void CloseSockets();
 
+	// Convert a 64 bit value between host and network byte order.
+	unsigned __int64 Swap64(unsigned __int64 x);
+
 	// Socket address wrapper.
 	class Address
 	{
@@ -43,10 +46,14 @@ namespace ts
 
 		std::wstring ToString(bool port = true) const;
 
+		void SetPort(short port);
+
 		bool operator == (const Address & r) const { return size == r.size && memcmp(&addr, &r.addr, size) == 0; }
 		bool operator != (const Address & r) const { return size != r.size || memcmp(&addr, &r.addr, size) != 0; }
 
 		static Address LocalHost(short port = 0);
+		// Address reaching every host on the local network.
+		static Address Broadcast(short port);
 	};
 	
 	// Base socket class.
@@ -67,9 +74,18 @@ namespace ts
 		
 		void SetBlocking(bool blocking);
 
+		// Signal an event when any of the FD_* network events occur. The socket 
+		// is non-blocking from then on.
+		void Watch(HANDLE event, long events);
+		// The FD_* network events that occurred since the last call. Resets the event.
+		long NetworkEvents(HANDLE event);
+
 		void Close();
 		
 		bool IsValid() { return s != INVALID_SOCKET; }
+
+		// Take ownership of 'other'.
+		void Take(Socket & other);
 	};
 		
 	// TCP socket wrapper.
@@ -79,16 +95,21 @@ namespace ts
 		// Connection.
 		void Listen(const Address & addr, int queue = 1, bool blocking = true);
 		bool Accept(TcpSocket & listener, Address & addr, bool blocking = true);
+		void Connect(const Address & addr, bool blocking = true);
 
 		// Data transfer.
 		int Receive(void * buffer, int size, int timeout = 0);
 		int Send(void * buffer, int size, int timeout = 0);
 		
+		// True if the peer has closed the connection and everything it sent has 
+		// been read. The socket must be non-blocking.
+		bool IsClosed();
+
+		// Disable Nagle's algorithm.
+		void SetNoDelay(bool nodelay);
+
 		// Get peer address.
 		Address GetPeer();
-
-		// Take ownership of 'other'.
-		void Take(TcpSocket & other);
 	};
 
 	// UDP socket wrapper.
@@ -100,6 +121,9 @@ namespace ts
 		// Bind socket to local address.
 		void Bind(Address addr = Address(), bool blocking = true);
 
+		// Allow sending to broadcast addresses.
+		void SetBroadcast(bool broadcast);
+
 		// Data transfer.
 		int ReceiveFrom(void * buffer, int size, Address & from, int timeout = 0);
 		int SendTo(void * buffer, int size, const Address & to, int timeout = 0);
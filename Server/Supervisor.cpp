@@ -0,0 +1,72 @@
+#include "Supervisor.h"
+#include "Server.h"
+#include "Metrics.h"
+
+using namespace ts;
+
+// How often the heartbeat is checked, in milliseconds.
+const int CheckPeriod = 20;
+
+// How long the server thread may go without finishing a pass. A pass waits 
+// at most a second in total for the rest of packets from a slow client.
+const int StallTimeout = 2000;
+
+void Supervisor::Start(Server * server)
+{
+	Stop();
+	this->server = server;
+	Run();
+}
+
+void Supervisor::Main(const volatile bool & run)
+{
+	__int64 frequency = Frequency();
+	LONG beat = server->heartbeat;
+	__int64 last = Time();
+	bool stalled = false;
+	while(run)
+	{
+		Sleep(CheckPeriod);
+
+		__int64 now = Time();
+		if(server->heartbeat != beat)
+		{
+			if(stalled)
+			{
+				long us = (long)((now - last) * 1000000 / frequency);
+				Gauge(M_RECOVERY_US, us);
+				Log(OL_NOTIFY | OL_INFO, L"Server thread resumed after %li ms\r\n", us / 1000);
+				stalled = false;
+			}
+			beat = server->heartbeat;
+			last = now;
+			continue;
+		}
+
+		// A stalled thread is only reported. Killing it could leave a lock it holds, 
+		// such as the heap's or the log's, held for good.
+		if(server->Thread::IsRunning())
+		{
+			if(!stalled && now - last > StallTimeout * frequency / 1000)
+			{
+				stalled = true;
+				Count(M_STALLS);
+				Log(OL_NOTIFY | OL_ERROR, L"Server thread stalled (%li stalls)\r\n", Metric(M_STALLS));
+			}
+			continue;
+		}
+
+		try
+		{
+			server->Recover();
+			Gauge(M_RECOVERY_US, (long)((Time() - last) * 1000000 / frequency));
+		}
+		catch(std::exception & ex)
+		{
+			Log(OL_ERROR, L"%S", ex.what());
+		}
+		stalled = false;
+		beat = server->heartbeat;
+		last = Time();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include "Thread.h"
+
+class Server;
+
+// Watches the server thread's heartbeat, restarts the thread if it exits, and 
+// reports it if it stops making progress.
+class Supervisor : public ts::Thread
+{
+protected:
+	Server * server;
+
+	void Main(const volatile bool & run);
+
+public:
+	Supervisor() : server(NULL) { }
+
+	// Start watching a running server.
+	void Start(Server * server);
+};
+
+#endif
\ No newline at end of file
@@ -46,6 +46,7 @@ namespace ts
 		{
 			run = false;
 			WaitForSingleObject(thread, INFINITE);
+			CloseHandle(thread);
 			thread = NULL;
 		}
 	}
@@ -57,4 +58,93 @@ namespace ts
 		else
 			return false;
 	}
+
+	// avrt.dll is only available on Vista and later.
+	typedef HANDLE (WINAPI * AvSetMmThreadCharacteristicsFn)(LPCWSTR task, LPDWORD index);
+	typedef BOOL (WINAPI * AvSetMmThreadPriorityFn)(HANDLE avrt, int priority);
+	typedef BOOL (WINAPI * AvRevertMmThreadCharacteristicsFn)(HANDLE avrt);
+	const int AVRT_PRIORITY_CRITICAL = 2;
+
+	// Load avrt.dll the first time it's needed, and keep the one reference.
+	static HMODULE Avrt()
+	{
+		static void * volatile avrt = NULL;
+		if(!avrt)
+		{
+			HMODULE module = LoadLibrary(L"avrt.dll");
+			// Another thread may have loaded it first.
+			if(module && InterlockedCompareExchangePointer(&avrt, module, NULL) != NULL)
+				FreeLibrary(module);
+		}
+		return (HMODULE)avrt;
+	}
+
+	bool SetLowLatency(int core, HANDLE * task)
+	{
+		bool result = false;
+		if(task)
+			*task = NULL;
+
+		HMODULE avrt = Avrt();
+		if(avrt)
+		{
+			AvSetMmThreadCharacteristicsFn characteristics = (AvSetMmThreadCharacteristicsFn)GetProcAddress(avrt, "AvSetMmThreadCharacteristicsW");
+			AvSetMmThreadPriorityFn priority = (AvSetMmThreadPriorityFn)GetProcAddress(avrt, "AvSetMmThreadPriority");
+
+			DWORD index = 0;
+			HANDLE avtask = characteristics ? characteristics(L"Pro Audio", &index) : NULL;
+			if(avtask)
+			{
+				if(priority)
+					priority(avtask, AVRT_PRIORITY_CRITICAL);
+				if(task)
+					*task = avtask;
+				result = true;
+			}
+		}
+		if(!result)
+			result = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != FALSE;
+
+		if(core >= 0 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) == 0)
+			result = false;
+
+		return result;
+	}
+
+	void ClearLowLatency(HANDLE task)
+	{
+		if(task)
+		{
+			HMODULE avrt = Avrt();
+			if(avrt)
+			{
+				AvRevertMmThreadCharacteristicsFn revert = (AvRevertMmThreadCharacteristicsFn)GetProcAddress(avrt, "AvRevertMmThreadCharacteristics");
+				if(revert)
+					revert(task);
+			}
+		}
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+
+		DWORD_PTR process, system;
+		if(GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+			SetThreadAffinityMask(GetCurrentThread(), process);
+	}
+
+	bool LockMemory(const void * p, size_t size)
+	{
+		if(VirtualLock((void *)p, size))
+			return true;
+
+		// Grow the working set to make room and try again.
+		SIZE_T minimum, maximum;
+		if(!GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum))
+			return false;
+		SetProcessWorkingSetSize(GetCurrentProcess(), minimum + size, maximum + size);
+		return VirtualLock((void *)p, size) != FALSE;
+	}
+
+	void UnlockMemory(const void * p, size_t size)
+	{
+		VirtualUnlock((void *)p, size);
+	}
 }
\ No newline at end of file
@@ -25,6 +25,19 @@ namespace ts
 
 		virtual bool IsRunning();
 	};
+
+	// Raise the calling thread to MMCSS priority, or time critical priority if 
+	// MMCSS is unavailable. Pins the thread to a core if core >= 0. The MMCSS 
+	// task is stored in task, if given, for ClearLowLatency.
+	bool SetLowLatency(int core = -1, HANDLE * task = NULL);
+
+	// Undo SetLowLatency on the calling thread. task may be NULL.
+	void ClearLowLatency(HANDLE task);
+
+	// Lock memory into the working set.
+	bool LockMemory(const void * p, size_t size);
+	// Unlock memory locked by LockMemory.
+	void UnlockMemory(const void * p, size_t size);
 }
 
 #endif
\ No newline at end of file
@@ -25,4 +25,11 @@ namespace ts
 		QueryPerformanceFrequency((LARGE_INTEGER *)&f);
 		return f;
 	}
+
+	__int64 Microseconds()
+	{
+		__int64 t = Time();
+		__int64 f = Frequency();
+		return t / f * 1000000 + t % f * 1000000 / f;
+	}
 }
\ No newline at end of file
@@ -26,8 +26,40 @@ namespace ts
 		int error() const { return e; }
 	};
 
+	// Critical section wrapper.
+	class CriticalSection
+	{
+	private:
+		CRITICAL_SECTION cs;
+
+		CriticalSection(const CriticalSection & copy);
+		void operator = (const CriticalSection & assign);
+
+	public:
+		CriticalSection() { InitializeCriticalSection(&cs); }
+		~CriticalSection() { DeleteCriticalSection(&cs); }
+
+		void Enter() { EnterCriticalSection(&cs); }
+		void Leave() { LeaveCriticalSection(&cs); }
+	};
+
+	// Holds a critical section for the lifetime of the lock.
+	class Lock
+	{
+	private:
+		CriticalSection & cs;
+
+		Lock(const Lock & copy);
+		void operator = (const Lock & assign);
+
+	public:
+		Lock(CriticalSection & cs) : cs(cs) { cs.Enter(); }
+		~Lock() { cs.Leave(); }
+	};
+
 	__int64 Time();
 	__int64 Frequency();
+	__int64 Microseconds();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,180 @@
+package com.thingsstuff.touchpad;
+
+import android.content.Context;
+import android.os.SystemClock;
+import android.text.InputType;
+import android.util.AttributeSet;
+import android.view.KeyCharacterMap;
+import android.view.KeyEvent;
+import android.view.inputmethod.BaseInputConnection;
+import android.view.inputmethod.EditorInfo;
+import android.view.inputmethod.InputConnection;
+import android.widget.ImageButton;
+
+// Button that opens the soft keyboard and receives its text as edits to the
+// text being composed, instead of key events. Keyboards with autocorrect
+// rewrite whole words as they are typed, and an edit only carries the part
+// that changed. While modifiers are held, text is typed as key events
+// instead, so the modifiers apply to it.
+public class KeyboardButton extends ImageButton {
+	public interface OnComposeListener {
+		// Delete characters before the cursor, then insert text.
+		void onCompose(int deleted, String inserted);
+		// True while modifier keys are toggled on.
+		boolean modifiersHeld();
+	}
+	protected OnComposeListener listener = null;
+	
+	static final private int MaxCommitted = 256;
+
+	public KeyboardButton(Context context) {
+		super(context);
+	}
+	public KeyboardButton(Context context, AttributeSet attrs) {
+		super(context, attrs);
+	}
+	public KeyboardButton(Context context, AttributeSet attrs, int defStyle) {
+		super(context, attrs, defStyle);
+	}
+	
+	public void setOnComposeListener(OnComposeListener l) {
+		listener = l;
+	}
+
+	@Override
+	public boolean onCheckIsTextEditor() {
+		return listener != null;
+	}
+	@Override
+	public InputConnection onCreateInputConnection(EditorInfo outAttrs) {
+		if(listener == null)
+			return super.onCreateInputConnection(outAttrs);
+		// Keyboards send key events for a null input type, without composing.
+		if(listener.modifiersHeld())
+			outAttrs.inputType = InputType.TYPE_NULL;
+		else
+			outAttrs.inputType = InputType.TYPE_CLASS_TEXT | InputType.TYPE_TEXT_FLAG_AUTO_CORRECT;
+		outAttrs.imeOptions = EditorInfo.IME_FLAG_NO_EXTRACT_UI;
+		return new ComposingConnection();
+	}
+	
+	// Tracks the text being composed, and reports each change to it. Key events
+	// from the keyboard still go to the view's key listener.
+	protected class ComposingConnection extends BaseInputConnection {
+		protected String composing = "";
+		// Recently committed text before the cursor, to count what deletes remove.
+		protected StringBuilder committed = new StringBuilder();
+		
+		public ComposingConnection() {
+			super(KeyboardButton.this, false);
+		}
+		
+		// Replace the composing text, reporting only the part that changed.
+		protected void compose(CharSequence text) {
+			String s = text.toString();
+			int prefix = 0;
+			int n = Math.min(composing.length(), s.length());
+			while(prefix < n && composing.charAt(prefix) == s.charAt(prefix))
+				++prefix;
+			// Don't split a surrogate pair.
+			if(prefix > 0 && Character.isHighSurrogate(composing.charAt(prefix - 1)))
+				--prefix;
+			
+			int deleted = composing.codePointCount(prefix, composing.length());
+			if(deleted > 0 || prefix < s.length())
+				listener.onCompose(deleted, s.substring(prefix));
+			composing = s;
+		}
+		// Commit the composing text, keeping the end of it.
+		protected void commit() {
+			committed.append(composing);
+			int trim = committed.length() - MaxCommitted;
+			if(trim > 0) {
+				if(Character.isLowSurrogate(committed.charAt(trim)))
+					++trim;
+				committed.delete(0, trim);
+			}
+			composing = "";
+		}
+		
+		// Type text as key events to the view's key listener, which sends them
+		// with the modifiers. Characters without a key are sent as text.
+		protected void type(CharSequence text) {
+			String s = text.toString();
+			KeyCharacterMap map = KeyCharacterMap.load(KeyCharacterMap.BUILT_IN_KEYBOARD);
+			for(int i = 0; i < s.length(); ) {
+				int n = Character.charCount(s.codePointAt(i));
+				String c = s.substring(i, i + n);
+				KeyEvent[] events = n == 1 ? map.getEvents(c.toCharArray()) : null;
+				if(events != null) {
+					// Leave out the shift presses the map adds, the key events
+					// carry them in their meta state.
+					for(KeyEvent e : events)
+						if(!isModifier(e.getKeyCode()))
+							KeyboardButton.this.dispatchKeyEvent(e);
+				} else {
+					KeyboardButton.this.dispatchKeyEvent(new KeyEvent(SystemClock.uptimeMillis(), c, KeyCharacterMap.BUILT_IN_KEYBOARD, 0));
+				}
+				i += n;
+			}
+			// What was typed can't be deleted as text.
+			composing = "";
+			committed.setLength(0);
+		}
+		
+		protected boolean isModifier(int keyCode) {
+			switch(keyCode) {
+			case KeyEvent.KEYCODE_SHIFT_LEFT:
+			case KeyEvent.KEYCODE_SHIFT_RIGHT:
+			case KeyEvent.KEYCODE_ALT_LEFT:
+			case KeyEvent.KEYCODE_ALT_RIGHT:
+				return true;
+			default:
+				return false;
+			}
+		}
+		
+		@Override
+		public boolean setComposingText(CharSequence text, int newCursorPosition) {
+			if(listener.modifiersHeld())
+				type(text);
+			else
+				compose(text);
+			return true;
+		}
+		@Override
+		public boolean commitText(CharSequence text, int newCursorPosition) {
+			if(listener.modifiersHeld()) {
+				type(text);
+			} else {
+				compose(text);
+				commit();
+			}
+			return true;
+		}
+		@Override
+		public boolean finishComposingText() {
+			commit();
+			return true;
+		}
+		@Override
+		public boolean deleteSurroundingText(int beforeLength, int afterLength) {
+			// Only the text before the cursor can be deleted with backspace, 
+			// which deletes a code point at a time. The length is in UTF-16 
+			// units; text from before this connection is counted as units.
+			if(beforeLength > 0) {
+				String before = committed.toString() + composing;
+				int start = Math.max(before.length() - beforeLength, 0);
+				if(start > 0 && Character.isLowSurrogate(before.charAt(start)))
+					--start;
+				int deleted = before.codePointCount(start, before.length()) + Math.max(beforeLength - before.length(), 0);
+				listener.onCompose(deleted, "");
+				
+				int fromComposing = Math.min(before.length() - start, composing.length());
+				composing = composing.substring(0, composing.length() - fromComposing);
+				committed.setLength(Math.min(start, committed.length()));
+			}
+			return true;
+		}
+	}
+}
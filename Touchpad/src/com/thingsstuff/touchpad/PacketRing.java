@@ -0,0 +1,158 @@
+package com.thingsstuff.touchpad;
+
+import java.io.IOException;
+import java.io.OutputStream;
+import java.util.concurrent.atomic.AtomicLong;
+
+// Lock-free single producer, single consumer ring of outgoing packets. The
+// producer encodes packets in place and publishes them in batches, and the
+// consumer writes published bytes straight out of the ring, so nothing is
+// allocated per packet. Packets that can't be dropped are held by the
+// producer while the ring is full, and moved into it once there's room.
+public class PacketRing {
+	protected final byte[] ring;
+	protected final int mask;
+
+	// Bytes before head have been consumed, bytes before tail are published.
+	protected final AtomicLong head = new AtomicLong(0);
+	protected final AtomicLong tail = new AtomicLong(0);
+
+	// Producer state.
+	protected long write = 0;
+	protected long end = 0;
+	
+	// Packets held until there's room in the ring, in order. The packet being
+	// encoded goes here if held is set. The consumer only reads holding, and 
+	// sets dropHeld when it skips the published packets.
+	protected final byte[] overflow;
+	protected int overflowLength = 0;
+	protected boolean held = false;
+	protected volatile boolean holding = false;
+	protected volatile boolean dropHeld = false;
+
+	// Capacity must be a power of 2. Up to overflow bytes of packets are held
+	// while the ring is full.
+	public PacketRing(int capacity, int overflow) {
+		ring = new byte[capacity];
+		mask = capacity - 1;
+		this.overflow = new byte[overflow];
+	}
+
+	// Start encoding a packet of size bytes. Returns false if the ring is full.
+	public boolean begin(byte control, int size) {
+		return begin(control, size, 0);
+	}
+	// Start encoding a packet of size bytes, leaving at least reserve bytes
+	// free for other packets. Returns false if there isn't room.
+	public boolean begin(byte control, int size, int reserve) {
+		// Nothing goes ahead of the held packets.
+		spill();
+		if(overflowLength > 0 || ring.length - (write - head.get()) < size + reserve)
+			return false;
+		held = false;
+		end = write + size;
+		put(control);
+		return true;
+	}
+	// Start encoding a packet of size bytes, holding it behind the others if 
+	// the ring is full. Returns false if there isn't room to hold it either.
+	public boolean beginHeld(byte control, int size) {
+		if(begin(control, size))
+			return true;
+		if(overflow.length - overflowLength < size)
+			return false;
+		held = true;
+		holding = true;
+		end = overflowLength + size;
+		put(control);
+		return true;
+	}
+	// Finish the packet, zeroing any unused bytes.
+	public void end() {
+		while((held ? overflowLength : write) < end)
+			put((byte) 0);
+		held = false;
+	}
+
+	public void put(byte x) {
+		if(held)
+			overflow[overflowLength++] = x;
+		else
+			ring[(int) (write++ & mask)] = x;
+	}
+	public void putShort(short x) {
+		put((byte) (x >> 8));
+		put((byte) x);
+	}
+	public void putChar(char x) {
+		putShort((short) x);
+	}
+	public void putInt(int x) {
+		putShort((short) (x >> 16));
+		putShort((short) x);
+	}
+	public void putLong(long x) {
+		putInt((int) (x >> 32));
+		putInt((int) x);
+	}
+
+	// Move the held packets into the ring once there's room for all of them.
+	protected void spill() {
+		if(dropHeld) {
+			dropHeld = false;
+			overflowLength = 0;
+			holding = false;
+		}
+		if(overflowLength == 0 || ring.length - (write - head.get()) < overflowLength)
+			return;
+		for(int i = 0; i < overflowLength; ++i)
+			ring[(int) (write++ & mask)] = overflow[i];
+		overflowLength = 0;
+		holding = false;
+	}
+
+	// Make the encoded packets visible to the consumer, along with the held
+	// packets if there's room for them now.
+	public void publish() {
+		spill();
+		tail.set(write);
+	}
+	// Drop the packets that have not been published, and the held packets.
+	public void discard() {
+		write = tail.get();
+		overflowLength = 0;
+		holding = false;
+	}
+	public boolean hasUnpublished() {
+		return write != tail.get() || overflowLength > 0;
+	}
+
+	// Consumer.
+	public boolean isEmpty() {
+		return head.get() == tail.get();
+	}
+	// The producer is holding packets for lack of room.
+	public boolean isHolding() {
+		return holding;
+	}
+	// Write the published packets to out. They are only consumed once all of
+	// them are written, so if writing fails they are kept, starting at a
+	// packet boundary, to be written again or skipped.
+	public void drain(OutputStream out) throws IOException {
+		long h = head.get();
+		long t = tail.get();
+		while(h < t) {
+			int offset = (int) (h & mask);
+			int n = (int) Math.min(t - h, ring.length - offset);
+			out.write(ring, offset, n);
+			h += n;
+		}
+		head.set(t);
+	}
+	// Drop the published packets, and the held packets the next time the 
+	// producer starts or publishes one.
+	public void skip() {
+		head.set(tail.get());
+		dropHeld = true;
+	}
+}
@@ -16,7 +16,10 @@
 
 package com.thingsstuff.touchpad;
 
+import java.io.BufferedInputStream;
+import java.io.DataInputStream;
 import java.io.IOException;
+import java.io.UnsupportedEncodingException;
 import java.net.DatagramPacket;
 import java.net.DatagramSocket;
 import java.net.InetAddress;
@@ -26,6 +29,11 @@ import java.net.SocketException;
 import java.net.SocketTimeoutException;
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.ConcurrentLinkedQueue;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.locks.LockSupport;
 
 import com.thingsstuff.touchpad.R;
 
@@ -35,11 +43,16 @@ import android.content.Context;
 import android.content.DialogInterface;
 import android.content.Intent;
 import android.content.SharedPreferences;
+import android.content.pm.ApplicationInfo;
+import android.graphics.Color;
 import android.net.DhcpInfo;
 import android.net.wifi.WifiManager;
 import android.os.Bundle;
+import android.os.Debug;
 import android.os.Handler;
+import android.os.SystemClock;
 import android.preference.PreferenceManager;
+import android.text.ClipboardManager;
 import android.text.InputType;
 import android.text.method.PasswordTransformationMethod;
 import android.util.Log;
@@ -63,6 +76,7 @@ import android.widget.CompoundButton.OnCheckedChangeListener;
 import android.widget.EditText;
 import android.widget.ImageView;
 import android.widget.LinearLayout;
+import android.widget.TextView;
 import android.widget.ToggleButton;
 
 public class Touchpad extends Activity {
@@ -76,6 +90,8 @@ public class Touchpad extends Activity {
 	static final private int ADD_FAVORITE_ID = DISCONNECT_ID + 1;
 	static final private int PREFERENCES_ID = ADD_FAVORITE_ID + 1;
 	static final private int EXIT_ID = PREFERENCES_ID + 1;
+	static final private int SHORTCUTS_ID = EXIT_ID + 1;
+	static final private int SEND_CLIPBOARD_ID = SHORTCUTS_ID + 1;
 
 	// Context (server) menu.
 	static final private int FAVORITES_ID = CANCEL_ID + 1;
@@ -85,13 +101,41 @@ public class Touchpad extends Activity {
 	static final private int SERVER_FAVORITE_ID = Menu.FIRST + 1;
 	
 	static final protected int KeepAlive = 2000;
+	static final protected int FramePeriod = 16;
+	static final protected int GamepadPeriod = 8;
+	static final protected int OutgoingSize = 65536;
+	static final protected int DiscreteReserve = 4096;
 	static final private int DefaultPort = 2999;
 	static final private int MaxServers = 9;
+	static final private int MaxTextLength = 1024;
+	static final private int ClockSamples = 8;
+	static final private int UnlimitedCredits = Integer.MAX_VALUE / 2;
+	static final private int ReconnectDelay = 250;
+	static final private int MaxReconnectDelay = 4000;
+	static final private int ReconnectAttempts = 8;
+	static final private int ReconnectBuffer = 2000;
+	static final private int MaxClipboardChunk = 4096;
+	static final private int MaxClipboardSize = 16 << 20;
+	static final private int ClipboardInFlight = 8;
+	static final private int MaxMotionSamples = 64;
+	static final private int MotionScale = 16;
+	// Capabilities exchanged by the hello packet.
+	static final private int CapCredits = 0x0001;
+	static final private int CapMacros = 0x0002;
+	static final private int CapMotion = 0x0100;
+	static final private int CapCompose = 0x0200;
+	static final private int CapClipboard = 0x0400;
+	static final private int CapText = 0x0800;
+	static final private int CapTouch = 0x1000;
+	static final private int CapGamepad = 0x2000;
+	static final private int CapClock = 0x4000;
 
 	// Current preferences.
 	protected short Port;
 	protected float Sensitivity;
 	protected int MultitouchMode;
+	protected boolean RawTouch;
+	protected boolean Gamepad;
 	protected int Timeout;
 	protected boolean EnableScrollBar;
 	protected int ScrollBarWidth;
@@ -99,13 +143,14 @@ public class Touchpad extends Activity {
 
 	// State.
 	protected Handler timer = new Handler();
-	protected Socket server = null;
+	protected volatile Socket server = null;
 	protected ImageView touchpad;
 	protected View mousebuttons;
 	protected View keyboard, modifiers;
 	protected View media, browser;
 	protected ToggleButton[] button = { null, null };
 	protected ToggleButton key_shift, key_ctrl, key_alt;
+	protected TextView quality;
 	
 	public Touchpad() {
 	}
@@ -128,6 +173,7 @@ public class Touchpad extends Activity {
 		// Set keyboard events.
 		keyboard = (View) buttons.findViewById(R.id.keyboard);
 		keyboard.setOnClickListener(mKeyboardListener);
+		((KeyboardButton) keyboard).setOnComposeListener(mComposeListener);
 		keyboard.setOnKeyListener(mKeyListener);
 
 		// Keyboard modifiers.
@@ -138,6 +184,7 @@ public class Touchpad extends Activity {
 			public void onCheckedChanged(CompoundButton button, boolean checked) {
 				if(checked)	sendKeyDown((short)KeyEvent.KEYCODE_SHIFT_LEFT, (short) 0);
 				else		sendKeyUp((short)KeyEvent.KEYCODE_SHIFT_LEFT, (short) 0);
+				restartKeyboard();
 			}
 		});
 		
@@ -147,6 +194,7 @@ public class Touchpad extends Activity {
 				// CTRL key is not in this SDK version...
 				if(checked)	sendKeyDown((short)113, (short) 0);
 				else		sendKeyUp((short)113, (short) 0);
+				restartKeyboard();
 			}
 		});
 
@@ -155,10 +203,14 @@ public class Touchpad extends Activity {
 			public void onCheckedChanged(CompoundButton button, boolean checked) {
 				if(checked)	sendKeyDown((short)KeyEvent.KEYCODE_ALT_LEFT, (short) 0);
 				else		sendKeyUp((short)KeyEvent.KEYCODE_ALT_LEFT, (short) 0);
+				restartKeyboard();
 			}
 		});
 		
 				
+		// Connection quality.
+		quality = (TextView) buttons.findViewById(R.id.quality);
+				
 		// Set mouse button events.
 		mousebuttons = (LinearLayout) findViewById(R.id.mousebuttons);
 		
@@ -197,8 +249,7 @@ public class Touchpad extends Activity {
 		View volumedown = media.findViewById(R.id.volumedown);
 		volumedown.setOnClickListener(new OnClickListener() {
 			public void onClick(View arg0) {
-				for(int i = 0; i < 3; ++i)
-					sendKeyPress((short) KeyEvent.KEYCODE_VOLUME_DOWN, (short) 0);
+				sendKeyEvent((short) KeyEvent.KEYCODE_VOLUME_DOWN, 0, 3);
 			}
 		});
 		volumedown.setOnLongClickListener(new OnLongClickListener() {
@@ -210,8 +261,7 @@ public class Touchpad extends Activity {
 		View volumeup = media.findViewById(R.id.volumeup);
 		volumeup.setOnClickListener(new OnClickListener() {
 			public void onClick(View arg0) {
-				for(int i = 0; i < 3; ++i)
-					sendKeyPress((short) KeyEvent.KEYCODE_VOLUME_UP, (short) 0);
+				sendKeyEvent((short) KeyEvent.KEYCODE_VOLUME_UP, 0, 3);
 			}
 		});
 		volumeup.setOnLongClickListener(new OnLongClickListener() {
@@ -238,6 +288,12 @@ public class Touchpad extends Activity {
 			public void onClick(View v) { sendKeyPress((short) KeyEvent.KEYCODE_BACK, (short) 0); }
 		});
 		
+		// Start the network thread. Debug builds first check that encoding
+		// packets doesn't allocate.
+		network = new Network();
+		checkAllocations();
+		network.start();
+		
 		// Set up preferences.
 		PreferenceManager.setDefaultValues(this, R.xml.preferences, false);
 
@@ -248,6 +304,11 @@ public class Touchpad extends Activity {
 			touchpad.setImageResource(R.drawable.background_bad);
 	}
 	@Override
+	protected void onDestroy() {
+		network.quit();
+		super.onDestroy();
+	}
+	@Override
 	protected void onResume() {
 		super.onResume();
 
@@ -257,6 +318,8 @@ public class Touchpad extends Activity {
 		try { Port = (short) Integer.parseInt(preferences.getString("Port", Integer.toString(DefaultPort))); } catch(NumberFormatException ex) { Port = DefaultPort; }
 		Sensitivity = (float) preferences.getInt("Sensitivity", 50) / 25.0f + 0.1f;
 		try { MultitouchMode = Integer.parseInt(preferences.getString("MultitouchMode", "0")); } catch(NumberFormatException ex) { MultitouchMode = 0; }
+		RawTouch = preferences.getBoolean("RawTouch", false);
+		Gamepad = preferences.getBoolean("Gamepad", false);
 		Timeout = preferences.getInt("Timeout", 500) + 1;
 		EnableScrollBar = preferences.getBoolean("EnableScrollBar", preferences.getBoolean("EnableScroll", true));
 		ScrollBarWidth = preferences.getInt("ScrollBarWidth", 20);
@@ -284,10 +347,17 @@ public class Touchpad extends Activity {
 		else browser.setVisibility(View.GONE);
 		
 		timer.postDelayed(mKeepAliveListener, KeepAlive);
+		if(Gamepad)
+			timer.postDelayed(mGamepadListener, GamepadPeriod);
 	}
 	@Override
 	protected void onPause() {
 		timer.removeCallbacks(mKeepAliveListener);
+		timer.removeCallbacks(mFrameListener);
+		timer.removeCallbacks(mGamepadListener);
+		timer.removeCallbacks(mClipboardListener);
+		clipboard = null;
+		framePosted = false;
 		disconnect(true);
 		super.onPause();
 	}
@@ -334,25 +404,47 @@ public class Touchpad extends Activity {
 				
 			int index = e.findPointerIndex(pointerId);
 
-			float X = e.getX(index);
-			float Y = e.getY(index);
-			if(moving)
-				onMoveDelta((X - oldX) * Sensitivity, (Y - oldY) * Sensitivity);
-			else
-				moving = true;
-			oldX = X;
-			oldY = Y;
+			// The samples batched since the last event, then the current one.
+			int history = e.getHistorySize();
+			for(int h = 0; h <= history; ++h) {
+				float X = h < history ? e.getHistoricalX(index, h) : e.getX(index);
+				float Y = h < history ? e.getHistoricalY(index, h) : e.getY(index);
+				long time = h < history ? e.getHistoricalEventTime(h) : e.getEventTime();
+				if(moving)
+					onMoveSample((X - oldX) * Sensitivity, (Y - oldY) * Sensitivity, time);
+				else
+					moving = true;
+				oldX = X;
+				oldY = Y;
+			}
+			onMoveEnd();
 			return true;
 		}
 		public boolean cancel(MotionEvent e) {
 			return false;
 		}
 		
+		// By default, the samples of an event are summed into one delta.
+		protected float sumX, sumY;
+		protected boolean sampled = false;
+		public void onMoveSample(float dx, float dy, long time) {
+			sumX += dx;
+			sumY += dy;
+			sampled = true;
+		}
+		public void onMoveEnd() {
+			if(sampled)
+				onMoveDelta(sumX, sumY);
+			sumX = sumY = 0.0f;
+			sampled = false;
+		}
+		
 		public void onMoveDelta(float dx, float dy) { }
 		public void onClick() { }
 	};
 	protected class MoveAction extends Action {
-		public void onMoveDelta(float dx, float dy) { sendMove(dx, dy); }
+		public void onMoveSample(float dx, float dy, long time) { addMotionSample(dx, dy, time); }
+		public void onMoveEnd() { sendMotionSamples(); }
 		public void onClick() {
 			if (button[0].isChecked()) 
 				button[0].toggle();
@@ -403,7 +495,8 @@ public class Touchpad extends Activity {
 			return super.onUp(e); 
 		}
 
-		public void onMoveDelta(float dx, float dy) { sendMove(dx, dy); }
+		public void onMoveSample(float dx, float dy, long time) { addMotionSample(dx, dy, time); }
+		public void onMoveEnd() { sendMotionSamples(); }
 		public void onClick() { sendClick(1); }
 	}
 	
@@ -412,6 +505,17 @@ public class Touchpad extends Activity {
 		protected Action action = null;
 
 		public boolean onTouch(View v, MotionEvent e) {
+			if(Gamepad) {
+				onGamepadTouch(v, e);
+				return true;
+			}
+			
+			// Let the server recognize the gestures.
+			if(RawTouch && hasCapability(CapTouch)) {
+				sendTouch(v, e);
+				return true;
+			}
+			
 			switch(e.getAction() & MotionEvent.ACTION_MASK) {
 			case MotionEvent.ACTION_POINTER_DOWN:
 				if(action != null)
@@ -490,6 +594,20 @@ public class Touchpad extends Activity {
 			imm.showSoftInput(keyboard, InputMethodManager.SHOW_FORCED);
 		}
 	};
+	// The keyboard types key events instead of composing while modifiers are 
+	// held, which takes a new input connection.
+	protected void restartKeyboard() {
+		InputMethodManager imm = (InputMethodManager) getSystemService(Context.INPUT_METHOD_SERVICE);
+		imm.restartInput(keyboard);
+	}
+	KeyboardButton.OnComposeListener mComposeListener = new KeyboardButton.OnComposeListener() {
+		public void onCompose(int deleted, String inserted) {
+			sendCompose(deleted, inserted);
+		}
+		public boolean modifiersHeld() {
+			return key_shift.isChecked() || key_ctrl.isChecked() || key_alt.isChecked();
+		}
+	};
 	OnKeyListener mKeyListener = new OnKeyListener() {
 		public boolean onKey(View v, int keyCode, KeyEvent event) {
 			if(event.getAction() == KeyEvent.ACTION_DOWN)
@@ -502,13 +620,57 @@ public class Touchpad extends Activity {
 		}
 	};
 	
-	// Timer listener.
+	// Timer listeners.
 	Runnable mKeepAliveListener = new Runnable() {
 		public void run() {
-			sendNull();
+			// Nothing to keep alive while reconnecting.
+			if(!reconnecting) {
+				sendNull();
+				sendClock();
+			}
 			timer.postDelayed(this, KeepAlive);
 		}
 	};
+	Runnable mFrameListener = new Runnable() {
+		public void run() {
+			framePosted = false;
+			sendMotion(false);
+			flush();
+		}
+	};
+	Runnable mSpillListener = new Runnable() {
+		public void run() {
+			flush();
+		}
+	};
+	Runnable mGamepadListener = new Runnable() {
+		public void run() {
+			sendGamepad();
+			timer.postDelayed(this, GamepadPeriod);
+		}
+	};
+	Runnable mCreditListener = new Runnable() {
+		public void run() {
+			if(!motionPending)
+				return;
+			timer.removeCallbacks(mFrameListener);
+			mFrameListener.run();
+		}
+	};
+	Runnable mQualityListener = new Runnable() {
+		public void run() {
+			int r = rtt;
+			if(r < 0) {
+				quality.setVisibility(View.GONE);
+				return;
+			}
+			quality.setVisibility(View.VISIBLE);
+			quality.setText(getString(R.string.rtt, (r + 500) / 1000));
+			if(r < 20000) quality.setTextColor(Color.GREEN);
+			else if(r < 60000) quality.setTextColor(Color.YELLOW);
+			else quality.setTextColor(Color.RED);
+		}
+	};
 
 	// Keyboard events.
 	boolean ignoreKeyEvent(KeyEvent event) {
@@ -528,58 +690,365 @@ public class Touchpad extends Activity {
 	public boolean onKeyDown(int keyCode, KeyEvent event) {
 		if(ignoreKeyEvent(event))
 			return super.onKeyDown(keyCode, event);
+		if(Gamepad && onGamepadKey(keyCode, true))
+			return true;
 		
-		int c = event.getUnicodeChar();
-		if (c == 0 || Character.isISOControl(c) || key_shift.isChecked() || key_ctrl.isChecked() || key_alt.isChecked())
-			sendKeyPress((short) event.getKeyCode(), (short) event.getMetaState());
-		else
-			sendChar((char) c);
+		sendKeyRepeat(event, 1);
 		return true;
 	}
 	@Override
 	public boolean onKeyMultiple(int keyCode, int repeatCount, KeyEvent event) {
-		if(keyCode == KeyEvent.KEYCODE_UNKNOWN) {
-			String s = event.getCharacters();
-			for(int i = 0; i < s.length(); ++i)
-				sendChar(s.charAt((i)));
+		if(keyCode == KeyEvent.KEYCODE_UNKNOWN)
+			sendText(event.getCharacters());
+		else if(!ignoreKeyEvent(event))
+			sendKeyRepeat(event, repeatCount);
+		return true;
+	}
+	// Send a key event repeated count times, as characters if it has any and
+	// no modifiers are toggled on.
+	protected void sendKeyRepeat(KeyEvent event, int count) {
+		int c = event.getUnicodeChar();
+		if (c == 0 || Character.isISOControl(c) || key_shift.isChecked() || key_ctrl.isChecked() || key_alt.isChecked()) {
+			sendKeyEvent((short) event.getKeyCode(), event.getMetaState(), count);
+		} else if (count == 1 && !Character.isSupplementaryCodePoint(c)) {
+			sendChar((char) c);
 		} else {
-			for(int i = 0; i < repeatCount; ++i)
-				onKeyDown(keyCode, event);
+			StringBuilder s = new StringBuilder();
+			for(int i = 0; i < count; ++i)
+				s.appendCodePoint(c);
+			sendText(s.toString());
 		}
-		return true;
 	}
 	@Override
 	public boolean onKeyUp(int keyCode, KeyEvent event) {
 		if(ignoreKeyEvent(event))
 			return super.onKeyUp(keyCode,  event);
+		if(Gamepad)
+			onGamepadKey(keyCode, false);
 		
 		return true;
 	}
 	
+	// Network thread. Owns the server socket; the UI thread only queues
+	// packets and connection requests for it, and never blocks on I/O.
+	// Packets are passed through the outgoing ring, so queueing them does
+	// not allocate.
+	protected class Network extends Thread {
+		protected ConcurrentLinkedQueue<Runnable> queue = new ConcurrentLinkedQueue<Runnable>();
+		protected volatile boolean running = true;
+		
+		public Network() {
+			super("Touchpad network");
+		}
+		
+		// Queue a Runnable to run on the network thread.
+		public void post(Runnable r) {
+			queue.offer(r);
+			LockSupport.unpark(this);
+		}
+		// Wake the thread to send the outgoing packets.
+		public void wake() {
+			LockSupport.unpark(this);
+		}
+		public void quit() {
+			running = false;
+			LockSupport.unpark(this);
+		}
+		
+		public void run() {
+			while(running) {
+				if(!outgoing.isEmpty())
+					writeOutgoing();
+				if(reconnecting && SystemClock.uptimeMillis() >= reconnectAt)
+					tryReconnect();
+				
+				Runnable r = queue.poll();
+				if(r != null)
+					r.run();
+				else if(reconnecting)
+					LockSupport.parkNanos(this, Math.max(reconnectAt - SystemClock.uptimeMillis(), 1) * 1000000L);
+				else if(outgoing.isEmpty())
+					LockSupport.park(this);
+			}
+		}
+	}
+	protected Network network;
+	
+	// Background reconnection after the connection drops, on the network thread.
+	// Until the new session is up, motion is merged as if the server were out of
+	// credits, and buttons and keys are held in the outgoing ring for a while.
+	protected volatile boolean reconnecting = false;
+	protected long droppedAt;
+	protected long reconnectAt;
+	protected int reconnectAttempts;
+	
+	// Reads packets from the server. One is started for each connection, and
+	// it exits when the socket is closed.
+	protected class Reader extends Thread {
+		protected Socket socket;
+		
+		public Reader(Socket socket) {
+			super("Touchpad reader");
+			this.socket = socket;
+		}
+		
+		public void run() {
+			int reason = -1;
+			try {
+				DataInputStream in = new DataInputStream(new BufferedInputStream(socket.getInputStream()));
+				while(reason < 0) {
+					int control = in.readUnsignedByte();
+					long received = clientTime();
+					switch(control) {
+					case 0x01:
+						reason = in.readUnsignedByte();
+						in.readFully(new byte[3]);
+						break;
+					case 0x06:
+						if(in.readUnsignedShort() != 36)
+							throw new IOException("Bad clock packet");
+						in.readUnsignedShort();
+						long origin = in.readLong();
+						long receive = in.readLong();
+						long transmit = in.readLong();
+						in.readLong();
+						in.readInt();
+						onClock(origin, receive, transmit, received);
+						break;
+					case 0x07:
+						if(credits.getAndAdd(in.readInt()) < lowCredits)
+							runOnUiThread(mCreditListener);
+						break;
+					case 0x08:
+						char[] names = new char[in.readUnsignedShort()];
+						in.readUnsignedShort();
+						for(int i = 0; i < names.length; ++i)
+							names[i] = in.readChar();
+						shortcuts = new String(names).split("\n");
+						break;
+					case 0x09:
+						onHello(in.readUnsignedShort(), in.readUnsignedShort());
+						break;
+					default:
+						in.readFully(new byte[4]);
+						break;
+					}
+				}
+			} catch(IOException e) { }
+			
+			// Reconnect, unless the socket was closed on purpose or the server
+			// said why it closed it.
+			final boolean dropped = reason < 0;
+			network.post(new Runnable() {
+				public void run() {
+					if(dropped)
+						onDrop(socket);
+					else
+						onClosed(socket);
+				}
+			});
+		}
+	}
+	
+	// The server answered the hello packet, on the reader thread. Until then
+	// it's treated as a server without flow control. The packets sent so far,
+	// the hello included, come out of the window it grants.
+	protected volatile int serverCapabilities = 0;
+	
+	protected void onHello(int capabilities, int window) {
+		serverCapabilities = capabilities;
+		if(window > 0) {
+			creditWindow = window;
+			lowCredits = window / 4;
+			credits.addAndGet(window - UnlimitedCredits);
+		}
+		runOnUiThread(new Runnable() {
+			public void run() { sendClock(); }
+		});
+	}
+	// Servers older than the hello packet misparse the newer packets, so each
+	// is only sent once the server has listed it.
+	protected boolean hasCapability(int capability) {
+		return (serverCapabilities & capability) != 0;
+	}
+	
+	// Clock synchronization, on the reader thread. The offset is taken from 
+	// the recent exchange with the lowest round trip time, which had the least
+	// queueing delay. The samples are reset by the network thread when the 
+	// connection closes, so both hold clockLock.
+	protected final Object clockLock = new Object();
+	protected volatile int rtt = -1;
+	protected volatile long clockOffset = 0;
+	protected long[] clockRtts = new long[ClockSamples];
+	protected long[] clockOffsets = new long[ClockSamples];
+	protected int clockCount = 0;
+	
+	protected static long clientTime() {
+		return System.nanoTime() / 1000;
+	}
+	protected void resetClock() {
+		synchronized(clockLock) {
+			rtt = -1;
+			clockCount = 0;
+		}
+		runOnUiThread(mQualityListener);
+	}
+	protected void onClock(long origin, long receive, long transmit, long received) {
+		long sampleRtt = (received - origin) - (transmit - receive);
+		synchronized(clockLock) {
+			int i = clockCount++ % ClockSamples;
+			clockRtts[i] = sampleRtt;
+			clockOffsets[i] = ((receive - origin) + (transmit - received)) / 2;
+			
+			int best = 0;
+			for(int j = 1; j < Math.min(clockCount, ClockSamples); ++j)
+				if(clockRtts[j] < clockRtts[best])
+					best = j;
+			clockOffset = clockOffsets[best];
+			
+			// Smoothed round trip time.
+			int r = rtt;
+			rtt = r < 0 ? (int) sampleRtt : (int) ((7L * r + sampleRtt) / 8);
+		}
+		runOnUiThread(mQualityListener);
+	}
+	
 	// Connection management.
 	protected boolean isConnected() {
-		reconnect();
+		if(server == null)
+			reconnect();
 		return server != null;
 	}
 	
+	// Reconnect to the default server in the background, if there is one.
 	protected void reconnect() {
+		network.post(new Runnable() {
+			public void run() {
+				if(server == null && !reconnecting)
+					doReconnect();
+			}
+		});
+	}
+	
+	// Called on the UI thread with the result of a connection attempt.
+	protected interface OnConnectListener {
+		void onConnect(boolean connected);
+	}
+	
+	protected void connect(String to) { connect(to, 0); }
+	protected void connect(final String to, int password) { connect(to, password, null); }
+	protected void connect(final String to, final int password, final OnConnectListener listener) {
+		network.post(new Runnable() {
+			public void run() { 
+				stopReconnect();
+				final boolean connected = doConnect(to, password, false);
+				if(listener != null) {
+					runOnUiThread(new Runnable() {
+						public void run() { listener.onConnect(connected); }
+					});
+				}
+			}
+		});
+	}
+
+	protected void disconnect() { disconnect(false); }
+	protected void disconnect(final boolean reconnect) {
+		outgoing.discard();
+		network.post(new Runnable() {
+			public void run() { 
+				stopReconnect();
+				doDisconnect(reconnect); 
+			}
+		});
+	}
+	
+	// The following run on the network thread.
+	protected void onDrop(Socket socket) {
+		if(server == null || server != socket)
+			return;
+		
+		Log.i(LOG_TAG, "Connection lost, reconnecting");
+		doDisconnect(true);
+		
+		credits.set(0);
+		lowCredits = Math.max(lowCredits, 1);
+		droppedAt = SystemClock.uptimeMillis();
+		reconnectAt = droppedAt;
+		reconnectAttempts = 0;
+		reconnecting = true;
+	}
+	// The server closed the connection, such as for another client. Reconnecting 
+	// would boot that client in turn, so wait for the user to touch the pad.
+	protected void onClosed(Socket socket) {
+		if(server == null || server != socket)
+			return;
+		
+		Log.i(LOG_TAG, "Disconnected by the server");
+		outgoing.skip();
+		doDisconnect(true);
+		runOnUiThread(new Runnable() {
+			public void run() { touchpad.setImageResource(R.drawable.background_bad); }
+		});
+	}
+	protected void tryReconnect() {
+		int held = credits.get();
+		doReconnect();
+		if(server != null) {
+			// The packets held while reconnecting are sent in the new window.
+			if(held < 0)
+				credits.addAndGet(held);
+			reconnecting = false;
+			// Send the motion merged while the connection was down.
+			runOnUiThread(mCreditListener);
+			return;
+		}
+		
+		if(++reconnectAttempts >= ReconnectAttempts) {
+			Log.i(LOG_TAG, "Giving up reconnecting");
+			stopReconnect();
+			outgoing.skip();
+			doDisconnect(false);
+			return;
+		}
+		reconnectAt = SystemClock.uptimeMillis() + Math.min(ReconnectDelay << reconnectAttempts, MaxReconnectDelay);
+	}
+	protected void stopReconnect() {
+		if(!reconnecting)
+			return;
+		reconnecting = false;
+		credits.set(UnlimitedCredits);
+		lowCredits = 0;
+	}
+	protected void doReconnect() {
 		if(server == null) {
 			// Reconnect to default server.
 			SharedPreferences preferences = PreferenceManager.getDefaultSharedPreferences(this);
 			String to = preferences.getString("Server", null);
 			int password = preferences.getInt("Password", 0);
-			if (to != null)
-				connect(to, password, true);
+			if (to == null || doConnect(to, password, true))
+				return;
+
+			// The server may have a new address; look for it on its port.
+			ArrayList<String> servers = new ArrayList<String>();
+			try {
+				discover(servers, 1, parsePort(to), to);
+			} catch (Exception e) {
+				Log.e(LOG_TAG, "Failed to find " + to, e);
+			}
+			// This may be a retry in the background, so a failure stays quiet and 
+			// keeps the default server. Only success replaces it.
+			if (!servers.isEmpty() && !servers.get(0).equals(to) && doConnect(servers.get(0), password, true)) {
+				SharedPreferences.Editor editor = preferences.edit();
+				editor.putString("Server", servers.get(0));
+				editor.commit();
+			}
 		}
 	}
 	
-	protected boolean connect(String to) { return connect(to, 0); }
-	protected boolean connect(String to, boolean reconnect) { return connect(to, 0, reconnect); }
-	protected boolean connect(final String to, int password) { return connect(to, password, false); }
-	protected boolean connect(final String to, int password, boolean reconnect) {
-		disconnect(reconnect);
+	protected boolean doConnect(final String to, int password, boolean reconnect) {
+		doDisconnect(reconnect);
 		
-		server = new Socket();
+		Socket socket = new Socket();
 
 		try {
 			// Connect to server.
@@ -589,21 +1058,22 @@ public class Touchpad extends Activity {
 			if (addr.length > 1)
 				port = Short.parseShort(addr[addr.length - 1]);
 
-			server.connect(new InetSocketAddress(InetAddress.getByName(addr[0]), port), Timeout);
-			server.setSoTimeout(Timeout);
-			server.setTcpNoDelay(true);
+			socket.connect(new InetSocketAddress(InetAddress.getByName(addr[0]), port), Timeout);
+			socket.setSoTimeout(Timeout);
+			socket.setTcpNoDelay(true);
+			server = socket;
 
 			// Send connection packet.
 			sendConnect(password, reconnect);
 
 			// Get the response.
 			byte[] response = new byte[5];
-			if (server.getInputStream().read(response) != 5)
+			if (server == null || server.getInputStream().read(response) != 5)
 				throw new Exception(getString(R.string.error_connect));
 
 			// If not connected...
 			if (response[0] != 0x00) {
-				disconnect(false);
+				doDisconnect(false);
 
 				// If the reason is other than a bad password, throw error.
 				if (response[0] != 0x01 || response[1] != 0x01)
@@ -614,31 +1084,25 @@ public class Touchpad extends Activity {
 				if (reconnect || password != 0)
 					throw new Exception(getString(R.string.error_password));
 
+				runOnUiThread(new Runnable() {
+					public void run() { showPasswordDialog(to); }
+				});
+				return false;
+			}
 
-				// Prompt user for password and retry connect.
-				AlertDialog.Builder alert = new AlertDialog.Builder(this);
-
-				final EditText pw = new EditText(this);
-				pw.setInputType(InputType.TYPE_TEXT_VARIATION_PASSWORD);
-				pw.setTransformationMethod(new PasswordTransformationMethod());
-
-				alert.setTitle(R.string.password_title);
-				alert.setMessage(R.string.password_message);
-				alert.setView(pw);
-
-				alert.setPositiveButton(R.string.ok, new DialogInterface.OnClickListener() {
-						public void onClick(DialogInterface dialog, int whichButton) {
-							connect(to, Hash(pw.getText().toString()), false);
-						}
-					});
+			runOnUiThread(new Runnable() {
+				public void run() { touchpad.setImageResource(R.drawable.background); }
+			});
 
-				alert.setNegativeButton(R.string.cancel, null);
+			// Flow control waits for the answer to the hello packet, which used a credit.
+			serverCapabilities = 0;
+			credits.set(UnlimitedCredits - 1);
+			creditWindow = 0;
+			lowCredits = 0;
 
-				alert.show();
-				return isConnected();
-			}
-
-			touchpad.setImageResource(R.drawable.background);
+			// Read replies from the server until the socket is closed.
+			socket.setSoTimeout(0);
+			new Reader(socket).start();
 
 			if(!reconnect) {
 				// Store this server as the default.
@@ -652,20 +1116,26 @@ public class Touchpad extends Activity {
 			
 			return true;
 		} 
-		catch (Exception e) {
+		catch (final Exception e) {
 			Log.e(LOG_TAG, "Failed to connect to " + to, e);
 			
-			disconnect(false);
+			try {
+				socket.close();
+			} catch (Exception ex) { }
+			// Keep the server while reconnecting in the background.
+			doDisconnect(reconnect && reconnecting);
 
-			if(!reconnect)
-				showErrorDialog(getString(R.string.error_connecting) + " " + to, e);
+			if(!reconnect) {
+				runOnUiThread(new Runnable() {
+					public void run() { showErrorDialog(getString(R.string.error_connecting) + " " + to, e); }
+				});
+			}
 			
 			return false;
 		}
 	}
 
-	protected void disconnect() { disconnect(false); }
-	protected void disconnect(boolean reconnect) {
+	protected void doDisconnect(boolean reconnect) {
 		// Clear default server.
 		if(!reconnect) {
 			SharedPreferences.Editor editor = PreferenceManager.getDefaultSharedPreferences(this).edit();
@@ -681,42 +1151,190 @@ public class Touchpad extends Activity {
 			server.close();
 		} catch (Exception e) { }
 		server = null;
-		if(!reconnect)
-			touchpad.setImageResource(R.drawable.background_bad);
+		resetClock();
+		if(!reconnect) {
+			runOnUiThread(new Runnable() {
+				public void run() { touchpad.setImageResource(R.drawable.background_bad); }
+			});
+		}
 	}
 	
-	// Context menu.
-	protected void findServers(Menu menu) throws Exception {
-		// Broadcast ping to look for servers.
+	// Prompt user for password and retry connect.
+	protected void showPasswordDialog(final String to) {
+		AlertDialog.Builder alert = new AlertDialog.Builder(this);
+
+		final EditText pw = new EditText(this);
+		pw.setInputType(InputType.TYPE_TEXT_VARIATION_PASSWORD);
+		pw.setTransformationMethod(new PasswordTransformationMethod());
+
+		alert.setTitle(R.string.password_title);
+		alert.setMessage(R.string.password_message);
+		alert.setView(pw);
+
+		alert.setPositiveButton(R.string.ok, new DialogInterface.OnClickListener() {
+				public void onClick(DialogInterface dialog, int whichButton) {
+					connect(to, Hash(pw.getText().toString()));
+				}
+			});
+
+		alert.setNegativeButton(R.string.cancel, null);
+
+		alert.show();
+	}
+	
+	// Server discovery. Runs on its own thread, since it blocks until the
+	// timeout expires.
+	protected void findServers() {
+		new Thread("Touchpad discovery") {
+			public void run() {
+				final ArrayList<String> servers = new ArrayList<String>();
+				try {
+					findServers(servers);
+				} catch(final Exception e) {
+					runOnUiThread(new Runnable() {
+						public void run() { showErrorDialog(getString(R.string.error), e); }
+					});
+					return;
+				}
+				runOnUiThread(new Runnable() {
+					public void run() { showServers(servers); }
+				});
+			}
+		}.start();
+	}
+	protected void findServers(List<String> servers) throws Exception {
+		SharedPreferences preferences = PreferenceManager.getDefaultSharedPreferences(this);
+		discover(servers, MaxServers, 0, preferences.getString("Server", null));
+		
+		// Cache the servers found, they are probed directly next time.
+		StringBuilder found = new StringBuilder();
+		for (String server : servers) {
+			if (found.length() > 0)
+				found.append(',');
+			found.append(server);
+		}
+		SharedPreferences.Editor editor = preferences.edit();
+		editor.putString("Discovered", found.toString());
+		editor.commit();
+	}
+	
+	// Ping the LAN broadcast addresses, the last known server and the cached
+	// servers all at once, and collect up to max servers that reply on port
+	// (or any port if 0) before the timeout.
+	protected void discover(List<String> servers, int max, int port, String last) throws Exception {
 		DatagramSocket beacon = new DatagramSocket(null);
 		beacon.setBroadcast(true);
-		beacon.setSoTimeout(Timeout);
-
-		InetAddress broadcast = getBroadcastAddress();
 
 		byte[] buffer = new byte[] { 0x02, 0x00, 0x00, 0x00, 0x00 };
-		beacon.send(new DatagramPacket(buffer, 5, broadcast, Port));
-		if(Port != DefaultPort)
-			beacon.send(new DatagramPacket(buffer, 5, broadcast, DefaultPort));
+		ArrayList<InetSocketAddress> targets = new ArrayList<InetSocketAddress>();
+		
+		ArrayList<InetAddress> broadcasts = new ArrayList<InetAddress>();
+		try {
+			broadcasts.add(getBroadcastAddress());
+		} catch (Exception e) { }
+		broadcasts.add(InetAddress.getByName("255.255.255.255"));
+		for (InetAddress broadcast : broadcasts) {
+			targets.add(new InetSocketAddress(broadcast, Port));
+			if (Port != DefaultPort)
+				targets.add(new InetSocketAddress(broadcast, DefaultPort));
+		}
+
+		SharedPreferences preferences = PreferenceManager.getDefaultSharedPreferences(this);
+		String cached = preferences.getString("Discovered", "");
+		if (last != null)
+			cached = last + "," + cached;
+		for (String server : cached.split(",")) {
+			if (server.length() == 0)
+				continue;
+			try {
+				String[] addr = server.split("\\:");
+				targets.add(new InetSocketAddress(InetAddress.getByName(addr[0]), parsePort(server)));
+			} catch (Exception e) { }
+		}
+
+		for (InetSocketAddress target : targets) {
+			try {
+				beacon.send(new DatagramPacket(buffer, 5, target));
+			} catch (IOException e) {
+				Log.w(LOG_TAG, "Failed to ping " + target, e);
+			}
+		}
 
+		long deadline = SystemClock.uptimeMillis() + Timeout;
 		try {
-			// Add each ack to the menu.
-			for (int i = 0; i < MaxServers; ++i) {
-				byte[] port = new byte[5];
-				DatagramPacket ack = new DatagramPacket(port, 5);
-				beacon.receive(ack);
-
-				ByteBuffer parser = ByteBuffer.wrap(port);
-
-				if (parser.get() == 0x03)
-				{
-					String addr = ack.getAddress().toString().substring(1) + ":" + parser.getShort();
-					menu.add(SERVER_FOUND_ID, 0, 0, addr).setShortcut((char) (i + '1'), (char)(i + 'a'));
-				}
+			// Add each ack to the list.
+			byte[] ack = new byte[5];
+			DatagramPacket packet = new DatagramPacket(ack, 5);
+			while (servers.size() < max) {
+				int remaining = (int) (deadline - SystemClock.uptimeMillis());
+				if (remaining <= 0)
+					break;
+				beacon.setSoTimeout(remaining);
+				packet.setLength(5);
+				beacon.receive(packet);
+
+				ByteBuffer parser = ByteBuffer.wrap(ack);
+				if (parser.get() != 0x03)
+					continue;
+				int from = parser.getShort() & 0xFFFF;
+				if (port != 0 && from != port)
+					continue;
+				
+				String server = packet.getAddress().getHostAddress() + ":" + from;
+				if (!servers.contains(server))
+					servers.add(server);
+			}
+		} catch (SocketTimeoutException e) { 
+		} finally {
+			beacon.close();
+		}
+	}
+	
+	protected int parsePort(String server) {
+		String[] addr = server.split("\\:");
+		if (addr.length > 1)
+			return Integer.parseInt(addr[addr.length - 1]);
+		return Port;
+	}
+	protected void showServers(final List<String> servers) {
+		if(servers.isEmpty()) {
+			showErrorDialog(getString(R.string.error_noservers));
+			return;
+		}
+		
+		AlertDialog.Builder builder = new AlertDialog.Builder(this);
+		builder.setTitle(R.string.servers);
+		builder.setItems(servers.toArray(new String[servers.size()]), new DialogInterface.OnClickListener() {
+			public void onClick(DialogInterface dialog, int which) {
+				connect(servers.get(which), 0);
+			}
+		});
+		builder.setNegativeButton(R.string.cancel, null);
+		builder.show();
+	}
+	
+	// Server shortcuts, the macros the server sent when connecting.
+	protected volatile String[] shortcuts = null;
+	
+	protected void showShortcuts() {
+		final String[] names = shortcuts;
+		if(names == null || !isConnected()) {
+			showErrorDialog(getString(R.string.error_noshortcuts));
+			return;
+		}
+		
+		AlertDialog.Builder builder = new AlertDialog.Builder(this);
+		builder.setTitle(R.string.shortcuts);
+		builder.setItems(names, new DialogInterface.OnClickListener() {
+			public void onClick(DialogInterface dialog, int which) {
+				sendMacro(which);
 			}
-		} catch (SocketTimeoutException e) { }
+		});
+		builder.setNegativeButton(R.string.cancel, null);
+		builder.show();
 	}
 	
+	// Context menu.
 	protected int findFavorite(String server) {
 		SharedPreferences preferences = PreferenceManager.getDefaultSharedPreferences(this);
 		for(int i = 0; i < MaxServers; ++i) {
@@ -734,7 +1352,7 @@ public class Touchpad extends Activity {
 		menu.setHeaderTitle(R.string.servers);
 
 		//menu.addSubMenu(0, FAVORITES_ID, 0, R.string.favoriteservers).setHeaderTitle(R.string.servers);
-		menu.addSubMenu(0, FIND_SERVERS_ID, 1, R.string.findservers).setHeaderTitle(R.string.servers);
+		menu.add(0, FIND_SERVERS_ID, 1, R.string.findservers);
 		menu.add(0, SERVER_CUSTOM_ID, 2, R.string.customserver).setShortcut('1', 'c');
 		menu.add(0, CANCEL_ID, 3, R.string.cancel).setShortcut('2', 'x');
 	}
@@ -746,16 +1364,21 @@ public class Touchpad extends Activity {
 			return true;
 		} else if (item.getGroupId() == SERVER_FAVORITE_ID) {
 			// Connect to menu item server.
-			int slot = item.getItemId();
+			final int slot = item.getItemId();
 			
-			SharedPreferences preferences = PreferenceManager.getDefaultSharedPreferences(this);
+			final SharedPreferences preferences = PreferenceManager.getDefaultSharedPreferences(this);
 			int password = preferences.getInt("Password" + slot, 0);
-			if(!connect(item.getTitle().toString(), password)) {
-				SharedPreferences.Editor editor = preferences.edit();
-				editor.remove("Favorite" + slot);
-				editor.remove("Password" + slot);
-				editor.commit();
-			}
+			connect(item.getTitle().toString(), password, new OnConnectListener() {
+				public void onConnect(boolean connected) {
+					if(connected)
+						return;
+					// Forget favorites that can't be connected to.
+					SharedPreferences.Editor editor = preferences.edit();
+					editor.remove("Favorite" + slot);
+					editor.remove("Password" + slot);
+					editor.commit();
+				}
+			});
 			return true;
 		} else if (item.getItemId() == SERVER_CUSTOM_ID) {
 			// Prompt user for server to connect to.
@@ -784,15 +1407,7 @@ public class Touchpad extends Activity {
 
 			return true;
 		} else if (item.getItemId() == FIND_SERVERS_ID) {
-			try {
-				SubMenu servers = item.getSubMenu();
-				findServers(servers);
-				if(servers.size() == 0)
-					showErrorDialog(getString(R.string.error_noservers));
-					
-			} catch(Exception e) {
-				showErrorDialog(getString(R.string.error), e);				
-			}
+			findServers();
 			return true;
 		} else if (item.getItemId() == FAVORITES_ID) {
 			SubMenu servers = item.getSubMenu();
@@ -822,6 +1437,8 @@ public class Touchpad extends Activity {
 		//else
 			menu.add(0, DISCONNECT_ID, 1, R.string.disconnect).setShortcut('0', 'd');
 		//menu.add(0, ADD_FAVORITE_ID, 2, R.string.addfavorite).setShortcut('1', 'f').setEnabled(isConnected());
+		menu.add(0, SHORTCUTS_ID, 2, R.string.shortcuts).setShortcut('1', 's');
+		menu.add(0, SEND_CLIPBOARD_ID, 2, R.string.send_clipboard).setShortcut('4', 'v');
 		menu.add(0, PREFERENCES_ID, 3, R.string.preferences).setShortcut('2', 'p');
 		menu.add(0, EXIT_ID, 4, R.string.exit).setShortcut('3', 'q');
 		return true;
@@ -854,6 +1471,12 @@ public class Touchpad extends Activity {
 				}
 			}
 			return true;
+		case SHORTCUTS_ID:
+			showShortcuts();
+			return true;
+		case SEND_CLIPBOARD_ID:
+			sendClipboard();
+			return true;
 		case PREFERENCES_ID:
 			startActivity(new Intent(this, Preferences.class));
 			return true;
@@ -865,115 +1488,668 @@ public class Touchpad extends Activity {
 		return super.onOptionsItemSelected(item);
 	}
 	
-	// Send packet.
-	void sendPacket(byte[] buffer) {
-		sendPacket(buffer, true, true);
+	// Packets waiting to be sent.
+	protected PacketRing outgoing = new PacketRing(OutgoingSize, DiscreteReserve);
+	protected boolean framePosted = false;
+	
+	// Flow control. Each packet sent uses a credit, and the server returns
+	// them as it injects the input. When credits run low, motion is merged
+	// into one packet per frame, and while they are exhausted it is held and
+	// checked less often. The data buffered ahead of the server stays bounded
+	// by the credit window instead of growing while the server is behind.
+	protected AtomicInteger credits = new AtomicInteger(UnlimitedCredits);
+	protected volatile int creditWindow = 0;
+	protected volatile int lowCredits = 0;
+	protected float pendingX, pendingY, pendingScroll, pendingScrollX, pendingScrollY;
+	protected boolean motionPending = false;
+	
+	protected boolean mergeMotion() {
+		return credits.get() < lowCredits;
+	}
+	// Send the merged motion. Unless forced, waits for credits.
+	protected void sendMotion(boolean force) {
+		if(!motionPending)
+			return;
+		if(!force && credits.get() <= 0) {
+			postFrame(4 * FramePeriod);
+			return;
+		}
+		
+		motionPending = false;
+		if(pendingX != 0.0f || pendingY != 0.0f) {
+			byte dx = floatToByte(pendingX);
+			byte dy = floatToByte(pendingY);
+			pendingX -= dx;
+			pendingY -= dy;
+			encodeMove(dx, dy);
+		}
+		if(pendingScroll != 0.0f) {
+			byte d = floatToByte(pendingScroll);
+			pendingScroll -= d;
+			encodeScroll(d);
+		}
+		if(pendingScrollX != 0.0f || pendingScrollY != 0.0f) {
+			byte dx = floatToByte(pendingScrollX);
+			byte dy = floatToByte(pendingScrollY);
+			pendingScrollX -= dx;
+			pendingScrollY -= dy;
+			encodeScroll2(dx, dy);
+		}
+		
+		// Motion beyond what fits in one packet goes with the next frame.
+		if(Math.abs(pendingX) >= 1.0f || Math.abs(pendingY) >= 1.0f || Math.abs(pendingScroll) >= 1.0f ||
+			Math.abs(pendingScrollX) >= 1.0f || Math.abs(pendingScrollY) >= 1.0f)
+			postMotion();
+	}
+	protected void postMotion() {
+		motionPending = true;
+		postFrame(FramePeriod);
+	}
+	
+	// Start a packet that can't be dropped, such as a button or key. These
+	// may use the room in the ring reserved for them, and if even that is
+	// full, are held until the network thread makes room; the UI thread
+	// never waits for it. Motion and other packets that are sent again or 
+	// replaced leave the reserve alone.
+	protected boolean beginPacket(byte control, int size) {
+		if(outgoing.beginHeld(control, size))
+			return true;
+		Log.e(LOG_TAG, "Outgoing packets are stuck, dropped packet " + control);
+		return false;
+	}
+	
+	// Check that encoding packets doesn't allocate, in debug builds. Runs
+	// before the network thread starts, and drops the packets encoded. The
+	// newer packets are checked as if a current server had answered.
+	protected void checkAllocations() {
+		if((getApplicationInfo().flags & ApplicationInfo.FLAG_DEBUGGABLE) == 0)
+			return;
+		
+		// The first pass loads classes and fills the message pool.
+		serverCapabilities = CapMotion | CapText;
+		encodeSamplePackets();
+		Debug.startAllocCounting();
+		Debug.resetThreadAllocCount();
+		encodeSamplePackets();
+		int count = Debug.getThreadAllocCount();
+		Debug.stopAllocCounting();
+		
+		serverCapabilities = 0;
+		credits.set(UnlimitedCredits);
+		residualX = residualY = 0.0f;
+		nullCount = 0;
+		if(count > 0)
+			Log.e(LOG_TAG, "Encoding packets allocated " + count + " objects");
+	}
+	protected void encodeSamplePackets() {
+		sendDown(0);
+		sendUp(0);
+		addMotionSample(1.0f, 2.0f, 0);
+		addMotionSample(3.0f, 4.0f, 8);
+		sendMotionSamples();
+		encodeMove(1.0f, 2.0f);
+		encodeScroll(1.0f);
+		sendKeyEvent((short) KeyEvent.KEYCODE_A, KeyEvent.META_SHIFT_ON, 1);
+		sendChar('a');
+		sendNull();
+		
+		outgoing.discard();
+		outgoing.skip();
+		timer.removeCallbacks(mFrameListener);
+		framePosted = false;
+	}
+	
+	// Send the packet now, along with any packets waiting for the next frame.
+	void sendPacket() {
+		outgoing.end();
+		credits.decrementAndGet();
+		flush();
+	}
+	// Send the packet with the next frame.
+	void postPacket() {
+		outgoing.end();
+		credits.decrementAndGet();
+		postFrame(FramePeriod);
+	}
+	void postFrame(int delay) {
+		if(!framePosted) {
+			framePosted = true;
+			timer.postDelayed(mFrameListener, delay);
+		}
 	}
-	void sendPacket(byte[] buffer, boolean allowConnect, boolean allowDisconnect) {
+	void flush() {
+		if(!outgoing.hasUnpublished())
+			return;
+		outgoing.publish();
+		network.wake();
+	}
+	// Write the outgoing packets to the server, on the network thread.
+	void writeOutgoing() {
+		try {
+			if(server == null && reconnecting) {
+				// Hold the packets for the new connection, unless they're stale.
+				if(SystemClock.uptimeMillis() - droppedAt > ReconnectBuffer) {
+					outgoing.skip();
+					credits.set(0);
+				}
+				return;
+			}
+			if(server == null)
+				doReconnect();
+			if(server != null) {
+				outgoing.drain(server.getOutputStream());
+				// Move the held packets into the room just made.
+				if(outgoing.isHolding())
+					runOnUiThread(mSpillListener);
+			} else {
+				outgoing.skip();
+			}
+		} catch (Exception e) {
+			Log.e(LOG_TAG, "Failed to send packets", e);
+			onDrop(server);
+		}
+	}
+	// Write packet to the server, on the network thread.
+	void write(byte[] buffer, boolean allowConnect, boolean allowDisconnect) {
 		try {
 			if(server == null && allowConnect) 
-				reconnect();
+				doReconnect();
 			if(server != null)
 				server.getOutputStream().write(buffer);
 		} catch (Exception e) {
 			Log.e(LOG_TAG, "Failed to send packet " + buffer[0], e);
 			if(allowDisconnect)
-				disconnect();
+				doDisconnect(false);
 		}
 	}
 	
 	// Mouse packets.
-	protected void sendMove(float dx, float dy) {
-		byte[] buffer = new byte[5];
-		ByteBuffer writer = ByteBuffer.wrap(buffer);
-		writer.order(ByteOrder.BIG_ENDIAN);
+	// Motion samples of the current move event, sent together in one packet.
+	protected float[] sampleX = new float[MaxMotionSamples];
+	protected float[] sampleY = new float[MaxMotionSamples];
+	protected long[] sampleTime = new long[MaxMotionSamples];
+	protected int sampleCount = 0;
+	// Fractions of a unit not sent yet, so rounding doesn't lose motion.
+	protected float residualX, residualY;
+	
+	protected void addMotionSample(float dx, float dy, long time) {
+		if(sampleCount == MaxMotionSamples)
+			sendMotionSamples();
+		sampleX[sampleCount] = dx;
+		sampleY[sampleCount] = dy;
+		sampleTime[sampleCount] = time;
+		++sampleCount;
+	}
+	protected void sendMotionSamples() {
+		int count = sampleCount;
+		sampleCount = 0;
+		if(count == 0)
+			return;
+		// Multi-sample move packet, followed by the samples in 1/16 pixels. The
+		// samples are merged instead while credits or room in the ring are low,
+		// or for servers that only take single moves.
+		if(mergeMotion() || !hasCapability(CapMotion) || !outgoing.begin((byte) 0x19, 5 + 6 * count, DiscreteReserve)) {
+			for(int i = 0; i < count; ++i) {
+				pendingX += sampleX[i];
+				pendingY += sampleY[i];
+			}
+			postMotion();
+			return;
+		}
+		outgoing.put((byte) count);
+		outgoing.put((byte) 0);
+		outgoing.putShort((short) 0);
+		for(int i = 0; i < count; ++i) {
+			float x = sampleX[i] * MotionScale + residualX;
+			float y = sampleY[i] * MotionScale + residualY;
+			short dx = (short) Math.max(-32768, Math.min(Math.round(x), 32767));
+			short dy = (short) Math.max(-32768, Math.min(Math.round(y), 32767));
+			residualX = x - dx;
+			residualY = y - dy;
+			outgoing.putShort(dx);
+			outgoing.putShort(dy);
+			outgoing.putShort((short) sampleTime[i]);
+		}
 
+		postPacket();
+	}
+	protected void encodeMove(float dx, float dy) {
 		// Move packet.
-		writer.put((byte) 0x11);
-		writer.put(floatToByte(dx));
-		writer.put(floatToByte(dy));
+		if(!outgoing.begin((byte) 0x11, 5, DiscreteReserve))
+			return;
+		outgoing.put(floatToByte(dx));
+		outgoing.put(floatToByte(dy));
 
-		sendPacket(buffer);
+		postPacket();
 	}
 	protected void sendDown(int button) {
-		byte[] buffer = new byte[5];
-		ByteBuffer writer = ByteBuffer.wrap(buffer);
-		writer.order(ByteOrder.BIG_ENDIAN);
-
+		// Motion before the button has to arrive before it.
+		sendMotion(true);
+		
 		// Down packet.
-		writer.put((byte) 0x12);
-		writer.put((byte) button);
+		if(!beginPacket((byte) 0x12, 5))
+			return;
+		outgoing.put((byte) button);
 
-		sendPacket(buffer);
+		sendPacket();
 	}
 	protected void sendUp(int button) {
-		byte[] buffer = new byte[5];
-		ByteBuffer writer = ByteBuffer.wrap(buffer);
-		writer.order(ByteOrder.BIG_ENDIAN);
-
-		// Down packet.
-		writer.put((byte) 0x13);
-		writer.put((byte) button);
+		sendMotion(true);
+		
+		// Up packet.
+		if(!beginPacket((byte) 0x13, 5))
+			return;
+		outgoing.put((byte) button);
 
-		sendPacket(buffer);
+		sendPacket();
 	}
 	protected void sendClick(int button) {
 		sendDown(button);
 		sendUp(button);
 	}
 	protected void sendScroll(float d) {
-		byte[] buffer = new byte[5];
-		ByteBuffer writer = ByteBuffer.wrap(buffer);
-		writer.order(ByteOrder.BIG_ENDIAN);
-
-		// Move packet.
-		writer.put((byte) 0x16);
-		writer.put(floatToByte(d));
+		if(mergeMotion()) {
+			pendingScroll += d;
+			postMotion();
+		} else {
+			encodeScroll(d);
+		}
+	}
+	protected void encodeScroll(float d) {
+		// Scroll packet.
+		if(!outgoing.begin((byte) 0x16, 5, DiscreteReserve))
+			return;
+		outgoing.put(floatToByte(d));
 
-		sendPacket(buffer);
+		postPacket();
 	}
 	protected void sendScroll2(float dx, float dy) {
-		byte[] buffer = new byte[5];
-		ByteBuffer writer = ByteBuffer.wrap(buffer);
-		writer.order(ByteOrder.BIG_ENDIAN);
+		if(mergeMotion()) {
+			pendingScrollX += dx;
+			pendingScrollY += dy;
+			postMotion();
+		} else {
+			encodeScroll2(dx, dy);
+		}
+	}
+	protected void encodeScroll2(float dx, float dy) {
+		// Scroll packet.
+		if(!outgoing.begin((byte) 0x17, 5, DiscreteReserve))
+			return;
+		outgoing.put(floatToByte(dx));
+		outgoing.put(floatToByte(dy));
+
+		postPacket();
+	}
 
-		// Move packet.
-		writer.put((byte) 0x17);
-		writer.put(floatToByte(dx));
-		writer.put(floatToByte(dy));
+	protected void sendTouch(View v, MotionEvent e) {
+		int action = e.getAction() & MotionEvent.ACTION_MASK;
+		int index = (e.getAction() & MotionEvent.ACTION_POINTER_INDEX_MASK) >> MotionEvent.ACTION_POINTER_INDEX_SHIFT;
+		
+		// Coordinates are sent in units of 1/16 of the touch slop.
+		ViewConfiguration vc = ViewConfiguration.get(touchpad.getContext());
+		float unit = vc.getScaledTouchSlop() / 16.0f;
+
+		int touch;
+		switch(action) {
+		case MotionEvent.ACTION_DOWN:
+		case MotionEvent.ACTION_POINTER_DOWN: touch = 0x00; break;
+		case MotionEvent.ACTION_MOVE: touch = 0x01; break;
+		case MotionEvent.ACTION_UP:
+		case MotionEvent.ACTION_POINTER_UP:
+		case MotionEvent.ACTION_CANCEL: touch = 0x02; break;
+		default: return;
+		}
+		
+		// Touch positions are absolute, so moves can be dropped when credits run
+		// low, as long as one gets through each frame.
+		if(touch == 0x01 && mergeMotion() && (framePosted || credits.get() <= 0))
+			return;
+		
+		// Moves and cancels apply to every pointer.
+		boolean all = action == MotionEvent.ACTION_MOVE || action == MotionEvent.ACTION_CANCEL;
+		int count = all ? e.getPointerCount() : 1;
+
+		// Touch packet, followed by the touch points. Only moves may be dropped.
+		boolean began = touch == 0x01 ? 
+			outgoing.begin((byte) 0x18, 5 + 8 * count, DiscreteReserve) : 
+			beginPacket((byte) 0x18, 5 + 8 * count);
+		if(!began)
+			return;
+		outgoing.put((byte) count);
+		outgoing.put((byte) MultitouchMode);
+		outgoing.putShort((short) (Sensitivity * unit * 256.0f));
+		for(int i = 0; i < count; ++i) {
+			int pointer = all ? i : index;
+			
+			int flags = touch;
+			if(touch == 0x00 && EnableScrollBar && ((e.getEdgeFlags() & MotionEvent.EDGE_RIGHT) != 0 || e.getX(pointer) > v.getWidth() - ScrollBarWidth))
+				flags |= 0x80;
+			
+			outgoing.put((byte) e.getPointerId(pointer));
+			outgoing.put((byte) flags);
+			outgoing.putShort((short) (e.getX(pointer) / unit));
+			outgoing.putShort((short) (e.getY(pointer) / unit));
+			outgoing.putShort((short) e.getEventTime());
+		}
+
+		// Only moves can wait for the next frame.
+		if(touch == 0x01)
+			postPacket();
+		else
+			sendPacket();
+	}
+
+	protected void sendMacro(int id) {
+		// Macro packet, the server injects the whole shortcut at once.
+		if(!beginPacket((byte) 0x25, 5))
+			return;
+		outgoing.putShort((short) id);
 
-		sendPacket(buffer);
+		sendPacket();
 	}
 
+	// Gamepad. The state is sent as a full snapshot at a fixed rate, so a 
+	// late or dropped packet can't leave a button stuck.
+	protected int padKeys = 0;
+	protected int padTouchButtons = 0;
+	protected int padLeftTrigger = 0, padRightTrigger = 0;
+	protected short padLeftX = 0, padLeftY = 0;
+	protected short padSequence = 0;
+	protected int stickPointer = -1;
+	protected float stickX, stickY;
+	
+	// Map controller keys to gamepad buttons (the same bits as XInput).
+	protected static int gamepadButton(int keyCode) {
+		switch(keyCode) {
+		case KeyEvent.KEYCODE_DPAD_UP: return 0x0001;
+		case KeyEvent.KEYCODE_DPAD_DOWN: return 0x0002;
+		case KeyEvent.KEYCODE_DPAD_LEFT: return 0x0004;
+		case KeyEvent.KEYCODE_DPAD_RIGHT: return 0x0008;
+		// KEYCODE_BUTTON_* are not in this SDK version...
+		case 108: return 0x0010;	// START
+		case 109: return 0x0020;	// SELECT
+		case 106: return 0x0040;	// THUMBL
+		case 107: return 0x0080;	// THUMBR
+		case 102: return 0x0100;	// L1
+		case 103: return 0x0200;	// R1
+		case 110: return 0x0400;	// MODE
+		case 96: return 0x1000;		// A
+		case 97: return 0x2000;		// B
+		case 99: return 0x4000;		// X
+		case 100: return 0x8000;	// Y
+		}
+		return 0;
+	}
+	protected boolean onGamepadKey(int keyCode, boolean down) {
+		// L2 and R2 are the triggers.
+		if(keyCode == 104) {
+			padLeftTrigger = down ? 255 : 0;
+			return true;
+		}
+		if(keyCode == 105) {
+			padRightTrigger = down ? 255 : 0;
+			return true;
+		}
+		
+		int button = gamepadButton(keyCode);
+		if(button == 0)
+			return false;
+		if(down) padKeys |= button;
+		else padKeys &= ~button;
+		return true;
+	}
+	
+	protected static short gamepadAxis(float x) {
+		return (short) (Math.max(-1.0f, Math.min(x, 1.0f)) * 32767.0f);
+	}
+	protected void onGamepadTouch(View v, MotionEvent e) {
+		int action = e.getAction() & MotionEvent.ACTION_MASK;
+		int up = -1;
+		if(action == MotionEvent.ACTION_UP || action == MotionEvent.ACTION_POINTER_UP)
+			up = (e.getAction() & MotionEvent.ACTION_POINTER_INDEX_MASK) >> MotionEvent.ACTION_POINTER_INDEX_SHIFT;
+		
+		// Full deflection of the stick is an eighth of the width from where it went down.
+		float radius = v.getWidth() / 8.0f;
+		boolean stick = false;
+		padTouchButtons = 0;
+		padLeftX = padLeftY = 0;
+		for(int i = 0; i < e.getPointerCount() && action != MotionEvent.ACTION_CANCEL; ++i) {
+			if(i == up)
+				continue;
+			
+			int id = e.getPointerId(i);
+			float x = e.getX(i);
+			float y = e.getY(i);
+			if(id == stickPointer || (!stick && stickPointer == -1 && x < v.getWidth() / 2)) {
+				// Left half is an analog stick centered where it went down.
+				if(stickPointer != id) {
+					stickPointer = id;
+					stickX = x;
+					stickY = y;
+				}
+				padLeftX = gamepadAxis((x - stickX) / radius);
+				padLeftY = gamepadAxis((stickY - y) / radius);
+				stick = true;
+			} else if(x >= v.getWidth() / 2) {
+				// Right half has the face buttons, X Y on top and A B below.
+				boolean top = y < v.getHeight() / 2;
+				boolean right = x >= 3 * v.getWidth() / 4;
+				if(top) padTouchButtons |= right ? 0x8000 : 0x4000;
+				else padTouchButtons |= right ? 0x2000 : 0x1000;
+			}
+		}
+		if(!stick)
+			stickPointer = -1;
+	}
+	
+	protected void sendGamepad() {
+		// A newer snapshot replaces this one, so don't wait for credits.
+		if(credits.get() <= 0 || !hasCapability(CapGamepad))
+			return;
+		
+		// Gamepad packet, followed by the state.
+		if(!outgoing.begin((byte) 0x30, 5 + 14, DiscreteReserve))
+			return;
+		outgoing.putShort((short) 14);
+		outgoing.putShort((short) 0);
+		outgoing.putShort(padSequence++);
+		outgoing.putShort((short) (padKeys | padTouchButtons));
+		outgoing.putShort(padLeftX);
+		outgoing.putShort(padLeftY);
+		outgoing.putShort((short) 0);
+		outgoing.putShort((short) 0);
+		outgoing.put((byte) padLeftTrigger);
+		outgoing.put((byte) padRightTrigger);
+		
+		sendPacket();
+	}
+	
 	// Keyboard packets.
 	protected void sendKey(byte control, short code, short flags) {
-		byte[] buffer = new byte[5];
-		ByteBuffer writer = ByteBuffer.wrap(buffer);
-		writer.order(ByteOrder.BIG_ENDIAN);
-
-		// Move packet.
-		writer.put(control);
-		writer.putShort(code);
-		writer.putShort(flags);
+		// Key packet.
+		if(!beginPacket(control, 5))
+			return;
+		outgoing.putShort(code);
+		outgoing.putShort(flags);
 
-		sendPacket(buffer);
+		sendPacket();
 	}
-	protected void sendKeyPress(short code, short flags) { sendKey((byte) 0x21, code, flags); }
+	protected void sendKeyPress(short code, short flags) { sendKeyEvent(code, flags, 1); }
 	protected void sendKeyDown(short code, short flags) { sendKey((byte) 0x22, code, flags); }
 	protected void sendKeyUp(short code, short flags) { sendKey((byte) 0x23, code, flags); }
+	protected void sendKeyEvent(short code, int meta, int repeat) {
+		int modifiers = 0;
+		if((meta & KeyEvent.META_SHIFT_ON) != 0) modifiers |= 0x01;
+		if((meta & 0x1000) != 0) modifiers |= 0x02; // KeyEvent.META_CTRL_ON
+		if((meta & KeyEvent.META_ALT_ON) != 0) modifiers |= 0x04;
+		if((meta & 0x10000) != 0) modifiers |= 0x08; // KeyEvent.META_META_ON
+		
+		// Older servers take the modifiers as separate key packets.
+		if(!hasCapability(CapText)) {
+			if((modifiers & 0x01) != 0) sendKeyDown((short) KeyEvent.KEYCODE_SHIFT_LEFT, (short) 0);
+			if((modifiers & 0x02) != 0) sendKeyDown((short) 113, (short) 0); // KeyEvent.KEYCODE_CTRL_LEFT
+			if((modifiers & 0x04) != 0) sendKeyDown((short) KeyEvent.KEYCODE_ALT_LEFT, (short) 0);
+			for(int i = 0; i < repeat; ++i)
+				sendKey((byte) 0x21, code, (short) 0);
+			if((modifiers & 0x04) != 0) sendKeyUp((short) KeyEvent.KEYCODE_ALT_LEFT, (short) 0);
+			if((modifiers & 0x02) != 0) sendKeyUp((short) 113, (short) 0); // KeyEvent.KEYCODE_CTRL_LEFT
+			if((modifiers & 0x01) != 0) sendKeyUp((short) KeyEvent.KEYCODE_SHIFT_LEFT, (short) 0);
+			return;
+		}
+		
+		// Split long repeats, the server wraps each packet in the modifiers.
+		while(repeat > 0) {
+			int count = Math.min(repeat, 255);
+			// Compound key packet.
+			if(!beginPacket((byte) 0x26, 5))
+				return;
+			outgoing.putShort(code);
+			outgoing.put((byte) modifiers);
+			outgoing.put((byte) count);
+			
+			sendPacket();
+			repeat -= count;
+		}
+	}
 	protected void sendChar(char code) {
-		byte[] buffer = new byte[5];
-		ByteBuffer writer = ByteBuffer.wrap(buffer);
-		writer.order(ByteOrder.BIG_ENDIAN);
+		// Char packet.
+		if(!beginPacket((byte) 0x20, 5))
+			return;
+		outgoing.putChar(code);
 
-		// Move packet.
-		writer.put((byte) 0x20);
-		writer.putChar(code);
+		sendPacket();
+	}
+	protected void sendText(String s) {
+		if(!hasCapability(CapText)) {
+			for(int i = 0; i < s.length(); ++i)
+				sendChar(s.charAt(i));
+			return;
+		}
+		for(int i = 0; i < s.length(); ) {
+			int length = Math.min(s.length() - i, MaxTextLength);
+			// Don't split a surrogate pair between packets.
+			if(i + length < s.length() && Character.isHighSurrogate(s.charAt(i + length - 1)))
+				--length;
+
+			// Text packet, followed by the UTF-16 string.
+			if(!beginPacket((byte) 0x24, 5 + 2 * length))
+				return;
+			outgoing.putShort((short) length);
+			outgoing.putShort((short) 0);
+			for(int j = 0; j < length; ++j)
+				outgoing.putChar(s.charAt(i + j));
+
+			sendPacket();
+			i += length;
+		}
+	}
 
-		sendPacket(buffer);
+	// Composition packet: delete characters before the cursor, then insert the
+	// UTF-16 string. Edits too large for one packet are split.
+	protected void sendCompose(int deleted, String s) {
+		// Older servers get backspaces and then the text.
+		if(!hasCapability(CapCompose)) {
+			sendKeyEvent((short) KeyEvent.KEYCODE_DEL, 0, deleted);
+			sendText(s);
+			return;
+		}
+		int i = 0;
+		do {
+			// The deletions go first, text only rides along with the last of
+			// them, so no backspace erases text this edit inserted.
+			int d = Math.min(deleted, MaxTextLength);
+			int length = deleted > MaxTextLength ? 0 : Math.min(s.length() - i, MaxTextLength);
+			// Don't split a surrogate pair between packets.
+			if(length > 0 && i + length < s.length() && Character.isHighSurrogate(s.charAt(i + length - 1)))
+				--length;
+
+			if(!beginPacket((byte) 0x27, 5 + 2 * length))
+				return;
+			outgoing.putShort((short) d);
+			outgoing.putShort((short) length);
+			for(int j = 0; j < length; ++j)
+				outgoing.putChar(s.charAt(i + j));
+
+			sendPacket();
+			deleted -= d;
+			i += length;
+		} while(deleted > 0 || i < s.length());
 	}
 
-	// Connection packets.
+	// Clipboard transfer. The text is sent in chunks a few at a time, as
+	// credits come back, so input sent meanwhile isn't queued behind it.
+	protected byte[] clipboard = null;
+	protected int clipboardSent = 0;
+	
+	protected void sendClipboard() {
+		ClipboardManager manager = (ClipboardManager) getSystemService(Context.CLIPBOARD_SERVICE);
+		CharSequence text = manager.getText();
+		if(text == null || text.length() == 0 || !isConnected()) {
+			showErrorDialog(getString(R.string.error_noclipboard));
+			return;
+		}
+		if(!hasCapability(CapClipboard)) {
+			showErrorDialog(getString(R.string.error_clipboardserver));
+			return;
+		}
+		
+		try {
+			clipboard = text.toString().getBytes("UTF-8");
+		} catch(UnsupportedEncodingException e) {
+			clipboard = null;
+		}
+		if(clipboard == null || clipboard.length > MaxClipboardSize) {
+			clipboard = null;
+			showErrorDialog(getString(R.string.error_clipboardsize));
+			return;
+		}
+		clipboardSent = 0;
+		timer.removeCallbacks(mClipboardListener);
+		mClipboardListener.run();
+	}
+	Runnable mClipboardListener = new Runnable() {
+		public void run() {
+			if(clipboard == null)
+				return;
+			if(!isConnected() && !reconnecting) {
+				clipboard = null;
+				return;
+			}
+			
+			for(int i = 0; i < ClipboardInFlight && clipboardSent < clipboard.length; ++i) {
+				if(creditWindow > 0 && credits.get() <= creditWindow - ClipboardInFlight)
+					break;
+				if(!sendClipboardChunk())
+					break;
+			}
+			if(clipboardSent < clipboard.length)
+				timer.postDelayed(this, FramePeriod);
+			else
+				clipboard = null;
+		}
+	};
+	protected boolean sendClipboardChunk() {
+		int length = Math.min(clipboard.length - clipboardSent, MaxClipboardChunk);
+		int flags = 0;
+		if(clipboardSent == 0) flags |= 0x01;
+		if(clipboardSent + length == clipboard.length) flags |= 0x02;
+		
+		// Clipboard packet, followed by the UTF-8 text.
+		if(!outgoing.begin((byte) 0x40, 5 + length, DiscreteReserve))
+			return false;
+		outgoing.putShort((short) length);
+		outgoing.put((byte) 0);
+		outgoing.put((byte) flags);
+		for(int i = 0; i < length; ++i)
+			outgoing.put(clipboard[clipboardSent + i]);
+		
+		sendPacket();
+		clipboardSent += length;
+		return true;
+	}
+
+	// Connection packets, sent from the network thread.
 	protected void sendConnect(int password, boolean silent) {
 		byte[] buffer = new byte[5];
 		ByteBuffer writer = ByteBuffer.wrap(buffer);
@@ -986,7 +2162,22 @@ public class Touchpad extends Activity {
 			writer.put((byte) 0x00);
 		writer.putInt(password);
 
-		sendPacket(buffer, false, true);
+		write(buffer, false, true);
+		
+		// Ask for the replies the reader handles. Servers that don't know the 
+		// hello packet ignore it, and never send any.
+		sendHello(CapCredits | CapMacros);
+	}
+	protected void sendHello(int capabilities) {
+		byte[] buffer = new byte[5];
+		ByteBuffer writer = ByteBuffer.wrap(buffer);
+		writer.order(ByteOrder.BIG_ENDIAN);
+
+		writer.put((byte) 0x09);
+		writer.putShort((short) capabilities);
+		writer.putShort((short) 0);
+
+		write(buffer, false, true);
 	}
 	protected void sendDisconnect(boolean silent) {
 		byte[] buffer = new byte[5];
@@ -999,21 +2190,33 @@ public class Touchpad extends Activity {
 		else
 			writer.put((byte) 0x01);
 
-		sendPacket(buffer, false, false);
+		write(buffer, false, false);
+	}
+
+	// Clock synchronization packet, the server fills in its timestamps and replies.
+	protected void sendClock() {
+		if(!hasCapability(CapClock) || !outgoing.begin((byte) 0x06, 5 + 36, DiscreteReserve))
+			return;
+		outgoing.putShort((short) 36);
+		outgoing.putShort((short) 0);
+		outgoing.putLong(clientTime());
+		outgoing.putLong(0);
+		outgoing.putLong(0);
+		outgoing.putLong(clockOffset);
+		outgoing.putInt(rtt);
+
+		sendPacket();
 	}
 
 	// Keep alive packet.
 	protected int nullCount = 0;
 	protected void sendNull() {
-		byte[] buffer = new byte[5];
-		ByteBuffer writer = ByteBuffer.wrap(buffer);
-		writer.order(ByteOrder.BIG_ENDIAN);
-		
-		writer.put((byte) 0xFF);
-		writer.putInt(nullCount);
+		if(!outgoing.begin((byte) 0xFF, 5, DiscreteReserve))
+			return;
+		outgoing.putInt(nullCount);
 		nullCount++;
 
-		sendPacket(buffer);
+		sendPacket();
 	}
 	
 	// Show error dialog